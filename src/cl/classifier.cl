@@ -0,0 +1,101 @@
+// Input patterns of the last CLASSIFIER_HISTORY steps are kept as cell bitplanes, weights as
+// CLASSIFIER_STEP_COUNT matrices of CLASSIFIER_BUCKET_COUNT weights per cell.
+
+inline int cellCount()
+{
+	return REGION_WIDTH * REGION_HEIGHT * REGION_DEPTH * COLUMN_CELL_COUNT;
+}
+inline int patternWords()
+{
+	return (cellCount() + 31) / 32;
+}
+inline global uint* getPattern(global uint* history, uint step)
+{
+	return history + (step % CLASSIFIER_HISTORY) * patternWords();
+}
+
+// Store the cells that are active or predictive on this step as the input pattern of the step
+void kernel recordPattern(
+	global const uint* cellStates,
+	int activeOffset,
+	int predictiveOffset,
+	global uint* history,
+	uint step)
+{
+	int w = get_global_id(0);
+	getPattern(history, step)[w] = cellStates[activeOffset + w] | cellStates[predictiveOffset + w];
+}
+
+// Sum the weights of the cells in a pattern for every bucket. Work-items run over (bucket, step count index).
+// When learning, the pattern recorded steps[k] steps ago is used, otherwise the pattern of this step.
+void kernel computeActivations(
+	global const float* weights,
+	global uint* history,
+	global const int* steps,
+	global float* activations,
+	uint step,
+	int learning)
+{
+	int bucket = get_global_id(0);
+	int k = get_global_id(1);
+
+	global const uint* pattern = getPattern(history, step - (learning ? steps[k] : 0));
+	global const float* bucketWeights = weights + k * cellCount() * CLASSIFIER_BUCKET_COUNT + bucket;
+
+	// Patterns are sparse, skip to the set bits
+	float sum = 0.0f;
+	for (int w = 0; w < patternWords(); ++w)
+	{
+		for (uint bits = pattern[w]; bits; bits &= bits - 1)
+		{
+			int cell = w * 32 + (31 - clz(bits & (~bits + 1)));
+			sum += bucketWeights[cell * CLASSIFIER_BUCKET_COUNT];
+		}
+	}
+	activations[k * CLASSIFIER_BUCKET_COUNT + bucket] = sum;
+}
+
+// Turn the activations of each step count into a probability distribution over buckets
+void kernel softmax(global float* activations)
+{
+	global float* a = activations + get_global_id(0) * CLASSIFIER_BUCKET_COUNT;
+
+	float highest = a[0];
+	for (int i = 1; i < CLASSIFIER_BUCKET_COUNT; ++i)
+		highest = max(highest, a[i]);
+
+	float sum = 0.0f;
+	for (int i = 0; i < CLASSIFIER_BUCKET_COUNT; ++i)
+	{
+		a[i] = exp(a[i] - highest);
+		sum += a[i];
+	}
+	for (int i = 0; i < CLASSIFIER_BUCKET_COUNT; ++i)
+		a[i] /= sum;
+}
+
+// Move the weights of the cells in the pattern of steps[k] steps ago towards the bucket seen now.
+// Work-items run over (pattern word, step count index), so only the rows of cells in the pattern are touched.
+void kernel learn(
+	global float* weights,
+	global uint* history,
+	global const int* steps,
+	global const float* probabilities,
+	int actualBucket,
+	float learningRate,
+	uint step)
+{
+	int w = get_global_id(0);
+	int k = get_global_id(1);
+
+	uint bits = getPattern(history, step - steps[k])[w];
+	global const float* p = probabilities + k * CLASSIFIER_BUCKET_COUNT;
+
+	for (; bits; bits &= bits - 1)
+	{
+		int cell = w * 32 + (31 - clz(bits & (~bits + 1)));
+		global float* row = weights + (k * cellCount() + cell) * CLASSIFIER_BUCKET_COUNT;
+		for (int i = 0; i < CLASSIFIER_BUCKET_COUNT; ++i)
+			row[i] += learningRate * ((i == actualBucket) - p[i]);
+	}
+}
@@ -0,0 +1,32 @@
+// Window of bits a field sets, see CLEncoder
+typedef struct
+{
+	int offset;
+	int width;
+	int height;
+	int startX;
+	int startY;
+	int sizeX;
+	int sizeY;
+} FieldWindow;
+
+// Work-items run over the input bits. Fields are few and sorted by offset, so each work-item walks the
+// table to find its own. Windows wrap around the edges of their field for periodic values.
+void kernel encodeFields(
+	global const FieldWindow* fields,
+	int fieldCount,
+	global char* input)
+{
+	int bit = get_global_id(0);
+
+	int f = 0;
+	while (f + 1 < fieldCount && fields[f + 1].offset <= bit)
+		++f;
+	FieldWindow field = fields[f];
+
+	int x = (bit - field.offset) % field.width;
+	int y = (bit - field.offset) / field.width;
+	input[bit] =
+		(x - field.startX + field.width) % field.width < field.sizeX &&
+		(y - field.startY + field.height) % field.height < field.sizeY;
+}
@@ -0,0 +1,58 @@
+// Counter-based random numbers (Philox4x32-10)
+//
+// Each value is a pure function of a key and a counter, so work-items don't carry generator state between
+// launches and the numbers drawn don't depend on scheduling or thread count. The counter is laid out as
+// (step, item, stream, block): item is normally the column index and stream tells apart the different
+// places that draw numbers, see randomstreams.h. CLRandom implements the same generator on the host.
+
+typedef struct
+{
+	uint2 key;
+	uint4 counter;
+	uint4 block; // values generated but not yet consumed
+	int remaining;
+} RandomStream;
+
+uint4 philox4x32(uint4 counter, uint2 key)
+{
+	for (int i = 0; i < 10; ++i)
+	{
+		uint hi0 = mul_hi(0xD2511F53u, counter.x);
+		uint lo0 = 0xD2511F53u * counter.x;
+		uint hi1 = mul_hi(0xCD9E8D57u, counter.z);
+		uint lo1 = 0xCD9E8D57u * counter.z;
+		counter = (uint4)(hi1 ^ counter.y ^ key.x, lo1, hi0 ^ counter.w ^ key.y, lo0);
+		key += (uint2)(0x9E3779B9u, 0xBB67AE85u);
+	}
+	return counter;
+}
+
+RandomStream makeRandomStream(uint2 key, uint step, uint item, RandomStreamId stream)
+{
+	RandomStream ret;
+	ret.key = key;
+	ret.counter = (uint4)(step, item, stream, 0);
+	ret.block = (uint4)(0);
+	ret.remaining = 0;
+	return ret;
+}
+
+uint random(RandomStream* rng)
+{
+	if (rng->remaining == 0)
+	{
+		rng->block = philox4x32(rng->counter, rng->key);
+		rng->counter.w++;
+		rng->remaining = 4;
+	}
+	rng->remaining--;
+	uint ret = rng->block.x;
+	rng->block = rng->block.yzwx;
+	return ret;
+}
+
+// Uniform float in [0, 1)
+float randfloat(RandomStream* rng)
+{
+	return (random(rng) >> 8) * (1.0f / 16777216.0f);
+}
@@ -0,0 +1,14 @@
+// Streams of the counter-based generator in random.cl. Shared by the kernels and by CLRandom on the host,
+// which draws some decisions itself, like CLArgs::learnsAt(), so both sides agree on the ids.
+#ifndef RANDOMSTREAMS_H_INCLUDED
+#define RANDOMSTREAMS_H_INCLUDED
+
+typedef enum {
+	RANDOM_STREAM_SPATIAL_INIT = 0,
+	RANDOM_STREAM_SPATIAL_REFINE,
+	RANDOM_STREAM_TEMPORAL_ACTIVE,
+	RANDOM_STREAM_TEMPORAL_PREDICTIVE,
+	RANDOM_STREAM_LEARNING // drawn on the host by CLArgs::learnsAt()
+} RandomStreamId;
+
+#endif
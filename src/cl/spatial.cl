@@ -14,26 +14,99 @@ typedef struct
 	float activeDutyCycle;
 	float minDutyCycle;
 	float overlapDutyCycle;
+
+	// Weakest proximal synapse, kept up to date wherever permanences change
+	float weakestPermanence;
+	int weakestSynapse;
 } Column;
 
-uint random(uint2* seedValue)
+// Specialization, set by CLSpecialization through build options
+#ifndef PROXIMAL_VECTOR_WIDTH
+#define PROXIMAL_VECTOR_WIDTH 1
+#endif
+#ifndef PROXIMAL_UNROLL
+#define PROXIMAL_UNROLL 1
+#endif
+
+#define PRAGMA(x) _Pragma(#x)
+#define UNROLL_BY(n) PRAGMA(unroll n)
+#define UNROLL(n) UNROLL_BY(n)
+
+// A Synapse is a (permanence, target) pair of words, so PROXIMAL_VECTOR_WIDTH synapses load as one vector
+// of twice the width with the permanences in the even and the targets in the odd lanes
+#if PROXIMAL_VECTOR_WIDTH == 2
+typedef float2 ProximalFloat;
+typedef int2 ProximalInt;
+typedef float4 ProximalSynapses;
+#define loadProximalSynapses(p) vload4(0, p)
+#define asProximalTargets(v) as_int2(v)
+#define gatherProximalInput(input, t) (ProximalFloat)(input[t.s0] != 0, input[t.s1] != 0)
+#define sumProximal(v) (v.s0 + v.s1)
+#elif PROXIMAL_VECTOR_WIDTH == 4
+typedef float4 ProximalFloat;
+typedef int4 ProximalInt;
+typedef float8 ProximalSynapses;
+#define loadProximalSynapses(p) vload8(0, p)
+#define asProximalTargets(v) as_int4(v)
+#define gatherProximalInput(input, t) (ProximalFloat)(input[t.s0] != 0, input[t.s1] != 0, input[t.s2] != 0, input[t.s3] != 0)
+#define sumProximal(v) dot(v, (float4)(1))
+#elif PROXIMAL_VECTOR_WIDTH == 8
+typedef float8 ProximalFloat;
+typedef int8 ProximalInt;
+typedef float16 ProximalSynapses;
+#define loadProximalSynapses(p) vload16(0, p)
+#define asProximalTargets(v) as_int8(v)
+#define gatherProximalInput(input, t) (ProximalFloat)(input[t.s0] != 0, input[t.s1] != 0, input[t.s2] != 0, input[t.s3] != 0, input[t.s4] != 0, input[t.s5] != 0, input[t.s6] != 0, input[t.s7] != 0)
+#define sumProximal(v) (dot(v.lo, (float4)(1)) + dot(v.hi, (float4)(1)))
+#endif
+
+// The grid kernels see a volume as its slices stacked into one grid of rows. They only run local
+// inhibition on 2D grids, where the two are the same, volumes go through the neighbour lists.
+#define REGION_ROWS (REGION_HEIGHT * REGION_DEPTH)
+
+// Record that the synapses of a column changed, so the next snapshot copies their block.
+// Blocks hold the synapses of SNAPSHOT_BLOCK_SIZE consecutive columns.
+inline void markSynapsesDirty(global uint* dirtyBlocks, int columnIndex)
 {
-	uint seed = (seedValue->x++) + get_global_id(0);
-	uint t = seed ^ (seed << 11);
-	return seedValue->y ^ (seedValue->y >> 19) ^ (t ^ (t >> 8));
+	int block = columnIndex / SNAPSHOT_BLOCK_SIZE;
+	uint bit = 1u << (block % 32);
+	if (!(dirtyBlocks[block / 32] & bit))
+		atomic_or(&dirtyBlocks[block / 32], bit);
+}
+
+void findWeakestSynapse(global Column* column, global Synapse* columnSynapses)
+{
+	column->weakestSynapse = 0;
+	column->weakestPermanence = columnSynapses[0].permanence;
+	for (int i = 1; i < COLUMN_PROXIMAL_SYNAPSE_COUNT; ++i)
+	{
+		if (columnSynapses[i].permanence < column->weakestPermanence)
+		{
+			column->weakestPermanence = columnSynapses[i].permanence;
+			column->weakestSynapse = i;
+		}
+	}
 }
-float randfloat(uint2* seedValue)
+
+// Random coordinate along an input axis within the receptive field radius of center
+int randomInputCoordinate(int center, int size, RandomStream* rng)
 {
-	uint i = random(seedValue) % 1000;
-	return i / 1000.0f;
+	if (RECEPTIVE_FIELD_RADIUS < 0 || (TOPOLOGY_WRAP && 2 * RECEPTIVE_FIELD_RADIUS >= size))
+		return random(rng) % size;
+	if (TOPOLOGY_WRAP)
+		return (center - RECEPTIVE_FIELD_RADIUS + random(rng) % max(2 * RECEPTIVE_FIELD_RADIUS, 1) + size) % size;
+
+	int from = max(0, center - RECEPTIVE_FIELD_RADIUS);
+	int to = min(size, center + RECEPTIVE_FIELD_RADIUS);
+	return from + random(rng) % max(to - from, 1);
 }
 
-void resetSynapse(global Synapse* synapse, int columnIndex, uint2* randomState)
+void resetSynapse(global Synapse* synapse, int columnIndex, global const int* receptiveFieldOffsets, global const int* receptiveFields, RandomStream* rng)
 {
 	// Calculate a pseudorandom permanence value centered at CONNECTED_PERMANENCE
 	float permanence = 0.0f;
-	permanence += randfloat(randomState);
-	permanence -= randfloat(randomState);
+	permanence += randfloat(rng);
+	permanence -= randfloat(rng);
 	permanence *= 0.5f;
 	permanence += CONNECTED_PERMANENCE;
 	if (permanence < 0.0f)
@@ -42,39 +115,42 @@ void resetSynapse(global Synapse* synapse, int columnIndex, uint2* randomState)
 		permanence = 1.0f;
 	synapse -> permanence = permanence;
 
+	// Pick the target from the receptive field list of the column, if the topology has them
+	if (RECEPTIVE_FIELD_LISTS)
+	{
+		int first = receptiveFieldOffsets[columnIndex];
+		int count = receptiveFieldOffsets[columnIndex + 1] - first;
+		synapse -> target = receptiveFields[first + random(rng) % count];
+		return;
+	}
+
 	// Calculate pseudorandom target bit based on receptive field radius
 	int columnX = columnIndex % REGION_WIDTH;
-	int columnY = columnIndex / REGION_WIDTH;
+	int columnY = columnIndex / REGION_WIDTH % REGION_HEIGHT;
+	int columnZ = columnIndex / (REGION_WIDTH * REGION_HEIGHT);
 
 	// Map column location in region to input space
 	int iX = INPUT_WIDTH  * ((float)columnX) / REGION_WIDTH;
 	int iY = INPUT_HEIGHT * ((float)columnY) / REGION_HEIGHT;
+	int iZ = INPUT_DEPTH  * ((float)columnZ) / REGION_DEPTH;
 
-	int minX = 0;
-	int minY = 0;
-	int maxX = INPUT_WIDTH;
-	int maxY = INPUT_HEIGHT;
-
-	if (RECEPTIVE_FIELD_RADIUS >= 0)
-	{
-		minX = max(0, iX - RECEPTIVE_FIELD_RADIUS);
-		minY = max(0, iY - RECEPTIVE_FIELD_RADIUS);
-		maxX = min(INPUT_WIDTH,  iX + RECEPTIVE_FIELD_RADIUS);
-		maxY = min(INPUT_HEIGHT, iY + RECEPTIVE_FIELD_RADIUS);
-	}
-
-	int x = minX + random(randomState) % (maxX-minX);
-	int y = minY + random(randomState) % (maxY-minY);
-	synapse -> target = x + y * INPUT_WIDTH;
+	int x = randomInputCoordinate(iX, INPUT_WIDTH, rng);
+	int y = randomInputCoordinate(iY, INPUT_HEIGHT, rng);
+	int z = INPUT_DEPTH > 1 ? randomInputCoordinate(iZ, INPUT_DEPTH, rng) : 0;
+	synapse -> target = x + (y + z * INPUT_HEIGHT) * INPUT_WIDTH;
 }
 
 void kernel initRegion(
 	global Column* columns,
 	global Synapse* synapses,
-	uint2 randomState)
+	global const int* receptiveFieldOffsets,
+	global const int* receptiveFields,
+	uint2 randomKey,
+	uint step)
 {
 	int columnIndex = get_global_id(0);
 	global Column* column = &columns[columnIndex];
+	RandomStream rng = makeRandomStream(randomKey, step, columnIndex, RANDOM_STREAM_SPATIAL_INIT);
 
 	// Column startup parameters
 	column -> boost = 0.0f;
@@ -88,32 +164,39 @@ void kernel initRegion(
 	for (int i = 0; i < COLUMN_PROXIMAL_SYNAPSE_COUNT; ++i)
 	{
 		global Synapse* synapse = &synapses[i + synapseOffset];
-		resetSynapse(synapse, columnIndex, &randomState);
+		resetSynapse(synapse, columnIndex, receptiveFieldOffsets, receptiveFields, &rng);
 	}
+	findWeakestSynapse(column, &synapses[synapseOffset]);
 }
 
-// Reset the worst synapse of each column
+// Reset the worst synapse of a slice of columns, starting at firstColumn and wrapping around the region.
+// Only columns that lose out to their neighbourhood or hold a synapse that decayed completely are touched.
 void kernel refineRegion(
 	global Column* columns,
 	global Synapse* synapses,
-	uint2 randomState)
+	global uint* dirtyBlocks,
+	global uint* resetCount, // synapses reset so far, for CLMetrics
+	global const int* receptiveFieldOffsets,
+	global const int* receptiveFields,
+	int firstColumn,
+	uint2 randomKey,
+	uint step)
 {
-	int columnIndex = get_global_id(0);
+	int columnIndex = (firstColumn + get_global_id(0)) % (REGION_WIDTH * REGION_ROWS);
 	global Column* column = &columns[columnIndex];
 
+	bool starving = column->activeDutyCycle < column->minDutyCycle;
+	bool deadSynapse = column->weakestPermanence <= 0.0f;
+	if (!starving && !deadSynapse)
+		return;
+
+	RandomStream rng = makeRandomStream(randomKey, step, columnIndex, RANDOM_STREAM_SPATIAL_REFINE);
+
 	int synapseOffset = columnIndex * COLUMN_PROXIMAL_SYNAPSE_COUNT;
-	int worstSynapseIndex = 0;
-	float worstSynapsePermanence = 0;
-	for (int i = 0; i < COLUMN_PROXIMAL_SYNAPSE_COUNT; ++i)
-	{
-		global Synapse* synapse = &synapses[i + synapseOffset];
-		if (i == 0 || synapse->permanence < worstSynapsePermanence)
-		{
-			worstSynapsePermanence = synapse->permanence;
-			worstSynapseIndex = i;
-		}
-	}
-	resetSynapse(&synapses[worstSynapseIndex + synapseOffset], columnIndex, &randomState);
+	resetSynapse(&synapses[column->weakestSynapse + synapseOffset], columnIndex, receptiveFieldOffsets, receptiveFields, &rng);
+	atomic_inc(resetCount);
+	markSynapsesDirty(dirtyBlocks, columnIndex);
+	findWeakestSynapse(column, &synapses[synapseOffset]);
 }
 
 void kernel computeOverlap(
@@ -129,7 +212,21 @@ void kernel computeOverlap(
 	float overlap = 0;
 
 	int synapseOffset = columnIndex * COLUMN_PROXIMAL_SYNAPSE_COUNT;
-	for (int i = 0; i < COLUMN_PROXIMAL_SYNAPSE_COUNT; ++i)
+	int i = 0;
+#if PROXIMAL_VECTOR_WIDTH > 1
+	ProximalFloat vectorOverlap = 0;
+	for (; i + PROXIMAL_VECTOR_WIDTH <= COLUMN_PROXIMAL_SYNAPSE_COUNT; i += PROXIMAL_VECTOR_WIDTH)
+	{
+		ProximalSynapses words = loadProximalSynapses((global const float*)&synapses[synapseOffset + i]);
+		ProximalInt targets = asProximalTargets(words.odd);
+		ProximalFloat inputs = gatherProximalInput(input, targets);
+		vectorOverlap += select((ProximalFloat)(0), inputs, words.even > CONNECTED_PERMANENCE);
+	}
+	overlap = sumProximal(vectorOverlap);
+#endif
+	// Scalar loop, or the synapses left over from the vector loop
+	UNROLL(PROXIMAL_UNROLL)
+	for (; i < COLUMN_PROXIMAL_SYNAPSE_COUNT; ++i)
 	{
 		global Synapse* syn = &synapses[synapseOffset + i];
 		overlap +=
@@ -150,91 +247,304 @@ void kernel computeOverlap(
 	col->overlap = overlap;
 }
 
+// Runs over the region padded to whole work-groups, each work-group handling a tile of columns.
+// The neighbourhoods of the tile are swept in blocks of tile size that are staged in local memory,
+// so each overlap is read from global memory once per work-group instead of once per neighbour.
 void kernel inhibitNeighbours(
 	global Column* columns,
-	global Synapse* synapses)
+	global Synapse* synapses,
+	local float* block,
+	int inhibitionRadius)
 {
-	int columnIndex = get_global_id(0);
-	global Column* col = &columns[columnIndex];
-
-	if (!col->active)
-		return;
-
-	// Given neighbourhood of nWidth*nHeight and total region topology of REGION_WIDTH*REGION_HEIGHT,
+	int colX = get_global_id(0);
+	int colY = get_global_id(1);
+	int tileWidth = get_local_size(0);
+	int tileHeight = get_local_size(1);
+	int localX = get_local_id(0);
+	int localY = get_local_id(1);
+
+	// Padding work-items only help loading blocks
+	bool inRegion = colX < REGION_WIDTH && colY < REGION_ROWS;
+	int columnIndex = colY * REGION_WIDTH + colX;
+	bool candidate = inRegion && columns[columnIndex].active;
+	float overlap = inRegion ? columns[columnIndex].overlap : 0.0f;
+
+	// Given neighbourhood of nWidth*nHeight and total region topology of REGION_WIDTH*REGION_ROWS,
 	// inhibit current column so that the neighbourhood has approximately SPARSITY_TARGET ratio of columns active
 
-	int nWidth = INHIBITION_RADIUS;
-	int nHeight = INHIBITION_RADIUS;
+	int nWidth = inhibitionRadius;
+	int nHeight = inhibitionRadius;
+	bool globalInhibition = nWidth == -1 || nHeight == -1;
 
-	int colX = columnIndex % REGION_WIDTH;
-	int colY = columnIndex / REGION_WIDTH;
+	int minX = max(colX-nWidth/2, 0);
+	int maxX = min(colX+nWidth/2+1, REGION_WIDTH);
+	int minY = max(colY-nHeight/2, 0);
+	int maxY = min(colY+nHeight/2+1, REGION_ROWS);
 
-	int minX = colX-nWidth/2;
-	int maxX = colX+nWidth/2+1;
-	int minY = colY-nHeight/2;
-	int maxY = colY+nHeight/2+1;
+	// Area covered by the neighbourhoods of the whole tile
+	int tileX = get_group_id(0) * tileWidth;
+	int tileY = get_group_id(1) * tileHeight;
+	int sweepMinX = max(tileX-nWidth/2, 0);
+	int sweepMaxX = min(tileX+tileWidth+nWidth/2, REGION_WIDTH);
+	int sweepMinY = max(tileY-nHeight/2, 0);
+	int sweepMaxY = min(tileY+tileHeight+nHeight/2, REGION_ROWS);
 
-	if (nWidth == -1 || nHeight == -1)
-	{
-		// Global inhibition
-		minX = 0;
-		maxX = REGION_WIDTH;
-		minY = 0;
-		maxY = REGION_HEIGHT;
-	}
-	else
+	if (globalInhibition)
 	{
-		if (minX < 0) minX = 0;
-		if (maxX > REGION_WIDTH) maxX = REGION_WIDTH;
-		if (minY < 0) minY = 0;
-		if (maxY > REGION_HEIGHT) maxY = REGION_HEIGHT;
+		minX = sweepMinX = 0;
+		maxX = sweepMaxX = REGION_WIDTH;
+		minY = sweepMinY = 0;
+		maxY = sweepMaxY = REGION_ROWS;
 	}
 
-	int numActiveColumns = 0;
-
-	int neighbours = (maxX-minX+1)*(maxY-minY+1);
+	// Neighbours exclude the column itself
+	int neighbours = (maxX-minX)*(maxY-minY) - 1;
 	int n = SPARSITY_TARGET * neighbours;
 
-	// Use partial selection sort to find the Nth activation
-	float activationSkip = -1.0f;
-	for (int k = 0; k < n+1; k++)
+	// The column stays active if its overlap is at least the (n+1)th highest of its neighbours,
+	// that is, if at most n neighbours have a higher overlap
+	int higher = 0;
+	for (int blockY = sweepMinY; blockY < sweepMaxY; blockY += tileHeight)
 	{
-		float bestActivation = -1.0f;
-		int bestActCount = 0;
-
-		for (int y = minY; y < maxY; ++y)
+		for (int blockX = sweepMinX; blockX < sweepMaxX; blockX += tileWidth)
 		{
-			for (int x = minX; x < maxX; ++x)
-			{
-				if (x == colX && y == colY) continue;
-
-				global Column* curColumn = &columns[y * REGION_WIDTH + x];
+			int x = blockX + localX;
+			int y = blockY + localY;
+			block[localY * tileWidth + localX] = (x < sweepMaxX && y < sweepMaxY) ? columns[y * REGION_WIDTH + x].overlap : 0.0f;
+			barrier(CLK_LOCAL_MEM_FENCE);
 
-				float act = curColumn->overlap;
-
-				if (activationSkip < 0 || act < activationSkip)
+			if (candidate)
+			{
+				int x0 = max(minX, blockX);
+				int x1 = min(maxX, blockX + tileWidth);
+				int y0 = max(minY, blockY);
+				int y1 = min(maxY, blockY + tileHeight);
+				for (int by = y0; by < y1; ++by)
 				{
-					if (act == bestActivation)
+					for (int bx = x0; bx < x1; ++bx)
 					{
-						bestActCount ++;
-					}
-					else if (act > bestActivation)
-					{
-						bestActivation = act;
-						bestActCount = 0;
+						if (bx == colX && by == colY) continue;
+						higher += block[(by - blockY) * tileWidth + (bx - blockX)] > overlap;
 					}
 				}
 			}
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+	}
+
+	if (candidate)
+		columns[columnIndex].active = higher <= n;
+}
+
+// Max over the block entries that fall in [from, to)
+inline float blockMax(local const float* block, int blockStart, int blockSize, int from, int to)
+{
+	float best = 0.0f;
+	for (int i = max(from, blockStart); i < min(to, blockStart + blockSize); ++i)
+		best = max(best, block[i - blockStart]);
+	return best;
+}
+
+// The highest activeDutyCycle in the inhibition neighbourhood of each column is found with a separable max filter:
+// maxDutyCycleRows takes the max along rows into rowMax and computeMinDutyCycles the max of those along columns.
+// Both passes run over row (or column) segments one work-group wide and sweep the window of the segment through
+// local memory in blocks of the same size, so each value is read from global memory once per work-group.
+void kernel maxDutyCycleRows(
+	global Column* columns,
+	global float* rowMax,
+	local float* block,
+	int inhibitionRadius)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int tileSize = get_local_size(0);
+	int tileX = get_group_id(0) * tileSize;
+
+	int half = inhibitionRadius / 2;
+	bool globalInhibition = inhibitionRadius == -1;
+	int minX = globalInhibition ? 0 : max(x-half, 0);
+	int maxX = globalInhibition ? REGION_WIDTH : min(x+half+1, REGION_WIDTH);
+	int sweepMinX = globalInhibition ? 0 : max(tileX-half, 0);
+	int sweepMaxX = globalInhibition ? REGION_WIDTH : min(tileX+tileSize+half, REGION_WIDTH);
+
+	float best = 0.0f;
+	for (int blockX = sweepMinX; blockX < sweepMaxX; blockX += tileSize)
+	{
+		int bx = blockX + get_local_id(0);
+		block[get_local_id(0)] = bx < sweepMaxX ? columns[y * REGION_WIDTH + bx].activeDutyCycle : 0.0f;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		best = max(best, blockMax(block, blockX, tileSize, minX, maxX));
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (x < REGION_WIDTH)
+		rowMax[y * REGION_WIDTH + x] = best;
+}
+
+void kernel computeMinDutyCycles(
+	global Column* columns,
+	global const float* rowMax,
+	local float* block,
+	int inhibitionRadius)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int tileSize = get_local_size(1);
+	int tileY = get_group_id(1) * tileSize;
+
+	int half = inhibitionRadius / 2;
+	bool globalInhibition = inhibitionRadius == -1;
+	int minY = globalInhibition ? 0 : max(y-half, 0);
+	int maxY = globalInhibition ? REGION_ROWS : min(y+half+1, REGION_ROWS);
+	int sweepMinY = globalInhibition ? 0 : max(tileY-half, 0);
+	int sweepMaxY = globalInhibition ? REGION_ROWS : min(tileY+tileSize+half, REGION_ROWS);
+
+	float best = 0.0f;
+	for (int blockY = sweepMinY; blockY < sweepMaxY; blockY += tileSize)
+	{
+		int by = blockY + get_local_id(1);
+		block[get_local_id(1)] = by < sweepMaxY ? rowMax[by * REGION_WIDTH + x] : 0.0f;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		best = max(best, blockMax(block, blockY, tileSize, minY, maxY));
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (y < REGION_ROWS)
+		columns[y * REGION_WIDTH + x].minDutyCycle = MIN_DUTY_CYCLE_FRACTION * best;
+}
+
+// Inhibition and min duty cycles over neighbour lists, for topologies that are not plain grids. Each column
+// only visits its own neighbours, so the cost follows the size of the neighbourhoods rather than of the region.
+void kernel inhibitNeighbourList(
+	global Column* columns,
+	global const int* neighbourOffsets,
+	global const int* neighbours)
+{
+	int columnIndex = get_global_id(0);
+	global Column* col = &columns[columnIndex];
+	if (!col->active)
+		return;
+
+	int first = neighbourOffsets[columnIndex];
+	int last = neighbourOffsets[columnIndex + 1];
+	int n = SPARSITY_TARGET * (last - first);
+
+	// Same rule as inhibitNeighbours: at most n neighbours may have a higher overlap
+	float overlap = col->overlap;
+	int higher = 0;
+	for (int i = first; i < last; ++i)
+		higher += columns[neighbours[i]].overlap > overlap;
+
+	col->active = higher <= n;
+}
+
+void kernel computeMinDutyCycleList(
+	global Column* columns,
+	global const int* neighbourOffsets,
+	global const int* neighbours)
+{
+	int columnIndex = get_global_id(0);
+	global Column* col = &columns[columnIndex];
+
+	float best = col->activeDutyCycle;
+	for (int i = neighbourOffsets[columnIndex]; i < neighbourOffsets[columnIndex + 1]; ++i)
+		best = max(best, columns[neighbours[i]].activeDutyCycle);
+
+	col->minDutyCycle = MIN_DUTY_CYCLE_FRACTION * best;
+}
+
+// Coordinate of an input bit along axis 0 (x), 1 (y) or 2 (z)
+inline int inputCoordinate(int target, int axis)
+{
+	if (axis == 0)
+		return target % INPUT_WIDTH;
+	if (axis == 1)
+		return target / INPUT_WIDTH % INPUT_HEIGHT;
+	return target / (INPUT_WIDTH * INPUT_HEIGHT);
+}
+
+// Extent along one axis of the connected synapses of a column, 0 if none is connected. On wrapped
+// topologies this is the shortest arc that holds them all, so fields across the edge stay narrow.
+int connectedSpan(global const Synapse* columnSynapses, int axis, int size)
+{
+	int minC = size;
+	int maxC = -1;
+	for (int i = 0; i < COLUMN_PROXIMAL_SYNAPSE_COUNT; ++i)
+	{
+		if (columnSynapses[i].permanence <= CONNECTED_PERMANENCE)
+			continue;
+		int c = inputCoordinate(columnSynapses[i].target, axis);
+		minC = min(minC, c);
+		maxC = max(maxC, c);
+	}
+	if (maxC < 0)
+		return 0;
+	if (!TOPOLOGY_WRAP)
+		return maxC - minC + 1;
+
+	// Start the arc at each connected coordinate in turn and go forward over the others
+	int best = maxC - minC + 1;
+	for (int i = 0; i < COLUMN_PROXIMAL_SYNAPSE_COUNT; ++i)
+	{
+		if (columnSynapses[i].permanence <= CONNECTED_PERMANENCE)
+			continue;
+		int start = inputCoordinate(columnSynapses[i].target, axis);
+		int extent = 0;
+		for (int j = 0; j < COLUMN_PROXIMAL_SYNAPSE_COUNT; ++j)
+		{
+			if (columnSynapses[j].permanence > CONNECTED_PERMANENCE)
+				extent = max(extent, (inputCoordinate(columnSynapses[j].target, axis) - start + size) % size);
 		}
-		k += bestActCount;
-		activationSkip = bestActivation;
+		best = min(best, extent + 1);
 	}
-	col->active = col->overlap >= activationSkip;
+	return best;
+}
+
+// Accumulate the extent in input space of the connected synapses of each column, for adapting the
+// inhibition radius. spans holds the sums of widths, heights and depths and the number of columns measured.
+void kernel measureReceptiveFields(
+	global Column* columns,
+	global Synapse* synapses,
+	global int* spans)
+{
+	int columnIndex = get_global_id(0);
+	global const Synapse* columnSynapses = &synapses[columnIndex * COLUMN_PROXIMAL_SYNAPSE_COUNT];
+
+	// Columns without connected synapses say nothing about locality
+	int spanX = connectedSpan(columnSynapses, 0, INPUT_WIDTH);
+	if (spanX == 0)
+		return;
+
+	atomic_add(&spans[0], spanX);
+	atomic_add(&spans[1], connectedSpan(columnSynapses, 1, INPUT_HEIGHT));
+	atomic_add(&spans[2], connectedSpan(columnSynapses, 2, INPUT_DEPTH));
+	atomic_inc(&spans[3]);
+}
+
+// Duty cycles and boosts follow every step, also those that do not learn, see CLArgs::LearningInterval.
+// minDutyCycle comes from computeMinDutyCycles.
+void kernel updateDutyCycles(global Column* columns)
+{
+	global Column* col = &columns[get_global_id(0)];
+
+	col->activeDutyCycle =
+		col->activeDutyCycle * DUTY_CYCLE_PERSISTENCE
+		+ col->active * (1.0f - DUTY_CYCLE_PERSISTENCE);
+
+	if (col->activeDutyCycle <= col->minDutyCycle)
+		col->boost += BOOST_STEP;
+	else
+		col->boost = max(1.0f, col->boost - BOOST_STEP);
+
+	col->overlapDutyCycle = (col->overlapDutyCycle * DUTY_CYCLE_PERSISTENCE) + (col->activeDutyCycle > col->minDutyCycle) * (1.0 - DUTY_CYCLE_PERSISTENCE);
 }
 
 void kernel updatePermanences(
 	global Column* columns,
 	global Synapse* synapses,
+	global uint* dirtyBlocks,
 	global const char* input)
 {
 	int columnIndex = get_global_id(0);
@@ -244,7 +554,10 @@ void kernel updatePermanences(
 
 	if (col->active)
 	{
+		markSynapsesDirty(dirtyBlocks, columnIndex);
+
 		// Update permanences
+		UNROLL(PROXIMAL_UNROLL)
 		for (int i = 0; i < COLUMN_PROXIMAL_SYNAPSE_COUNT; ++i)
 		{
 			global Synapse* syn = &synapses[columnSynapseOffset + i];
@@ -261,24 +574,21 @@ void kernel updatePermanences(
 				if (syn->permanence < 0.0)
 					syn->permanence = 0.0;
 			}
+
+			if (i == 0 || syn->permanence < col->weakestPermanence)
+			{
+				col->weakestPermanence = syn->permanence;
+				col->weakestSynapse = i;
+			}
 		}
 	}
 
-	// Update duty cycles
-	col->minDutyCycle = 0.01f * 0.1f; // 0.1 = maxDutyCycle of neighbourhood
-	col->activeDutyCycle =
-		col->activeDutyCycle * DUTY_CYCLE_PERSISTENCE
-		+ col->active * (1.0f - DUTY_CYCLE_PERSISTENCE);
-
-	if (col->activeDutyCycle <= col->minDutyCycle)
-		col->boost += BOOST_STEP;
-	else
-		col->boost = max(1.0f, col->boost - BOOST_STEP);
-
-	col->overlapDutyCycle = (col->overlapDutyCycle * DUTY_CYCLE_PERSISTENCE) + (col->activeDutyCycle > col->minDutyCycle) * (1.0 - DUTY_CYCLE_PERSISTENCE);
-
+	// Columns that rarely overlap strengthen all their synapses, with the duty cycles of updateDutyCycles
 	if (col->overlapDutyCycle < col->minDutyCycle)
 	{
+		// Inactive columns get here too, so the block may not be marked yet
+		markSynapsesDirty(dirtyBlocks, columnIndex);
+
 		// Increase permanences
 		for (int i = 0; i < COLUMN_PROXIMAL_SYNAPSE_COUNT; ++i)
 		{
@@ -288,6 +598,37 @@ void kernel updatePermanences(
 			if (syn->permanence > 1.0f)
 				syn->permanence = 1.0f;
 		}
+		// Every synapse moved by the same step, the weakest one stays the weakest
+		col->weakestPermanence = min(col->weakestPermanence + PERMANENCE_STEP, 1.0f);
 	}
 
 }
+
+void kernel clearBackwards(global int* result)
+{
+	result[get_global_id(0)] = 0;
+}
+
+// Count connected synapses of active columns per input bit. The second dimension runs over a batch of
+// column activations, each with its own histogram of INPUT_WIDTH * INPUT_HEIGHT * INPUT_DEPTH counters.
+void kernel backwards(
+	global const Synapse* synapses,
+	global const char* columnActivation,
+	global int* result)
+{
+	int columnIndex = get_global_id(0);
+	int batchIndex = get_global_id(1);
+
+	if (!columnActivation[batchIndex * get_global_size(0) + columnIndex])
+		return;
+
+	global int* histogram = result + batchIndex * INPUT_WIDTH * INPUT_HEIGHT * INPUT_DEPTH;
+	int columnSynapseOffset = columnIndex * COLUMN_PROXIMAL_SYNAPSE_COUNT;
+
+	for (int i = 0; i < COLUMN_PROXIMAL_SYNAPSE_COUNT; ++i)
+	{
+		global const Synapse* syn = &synapses[columnSynapseOffset + i];
+		if (syn->permanence > CONNECTED_PERMANENCE)
+			atomic_inc(&histogram[syn->target]);
+	}
+}
@@ -1,199 +1,365 @@
 typedef enum {NOW, WAS} TimeStep;
 
+// Cell states are kept as bitplanes, one bit per cell in each plane
 typedef enum {
-	ACTIVESTATE = 0x01,
-	PREDICTIVESTATE = 0x02,
-	LEARNSTATE = 0x04
+	ACTIVESTATE = 0,
+	PREDICTIVESTATE,
+	LEARNSTATE,
+	CELL_STATE_COUNT
 } CellState;
 
+typedef enum {
+	SEGMENT_SEQUENCE = 0x01,
+	SEGMENT_SEQUENCE_QUEUED = 0x02,
+	SEGMENT_QUEUED_CHANGES = 0x04
+} SegmentFlag;
+
+// Fields packed into a SegmentActivity word, SEGMENT_COUNTER_BITS bits each
+typedef enum {
+	ACTIVE_COUNTER = 0, // connected synapses to active cells
+	LEARN_COUNTER, // connected synapses to learning cells
+	FULL_ACTIVE_COUNTER // synapses to active cells, connected or not
+} SegmentCounter;
+
+// Counters reduced by updateSynapses for the anomaly score
+typedef enum {
+	ANOMALY_ACTIVE_COLUMNS = 0, // columns activated by the spatial pooler
+	ANOMALY_UNPREDICTED_COLUMNS, // of which no cell was predictive on the previous step
+	ANOMALY_COUNTER_COUNT
+} AnomalyCounter;
+
+// Layout of the segment pool allocator: a header followed by a stack of released segments
+typedef enum {
+	POOL_TOP = 0, // segments handed out from the end of the pool so far
+	POOL_FREE_COUNT, // entries on the free stack
+	POOL_FAILED, // allocations that found the pool exhausted
+	POOL_CAPACITY, // number of segments the pool can hold
+	POOL_SYNAPSES_RESET, // learning counters, only ever added to, read by the host for CLMetrics
+	POOL_SEGMENTS_ADAPTED,
+	POOL_HEADER_SIZE
+} PoolHeader;
+
 
 typedef struct
 {
 	float permanence;
 	float permanenceQueued; // segment updates from SegmentUpdate structures is flattened here
-	int targetColumn;
-	uchar targetCell;
-	uchar targetCellState;
+	int targetCell; // column * COLUMN_CELL_COUNT + cell
 } Synapse;
 
 typedef struct
 {
-	// Activity of the segment
-	// 0 = activeState, 1 = learnState
-	// 0 = now, 1 = previous timestep
-	uchar activity[2][2];
-
-	// Activity that includes synapses with permanence below CONNECTED_PERMANENCE but above MIN_PERMANENCE
-	// 0 = activeState, 1 = learnState
-	// 0 = now, 1 = previous timestep
-	uchar fullActivity[2][2];
-	bool sequenceSegment;
-	bool sequenceSegmentQueued;
-	bool hasQueuedChanges;
-
+	uchar synapseCount; // synapses in use, at most SEGMENT_SYNAPSE_COUNT
+	uchar flags; // see SegmentFlag
 	float activeDutyCycle; // how often this segment is active when the cell is active
 } Segment;
 
 typedef struct
 {
-	uchar state;
+	uchar segmentCount; // segments in use, at most CELL_SEGMENT_COUNT
 } Cell;
 
+// Summary of the segments of one cell, written once per step by scoreSegments()
+// Indexed by timeSlot()
+typedef struct
+{
+	char activeSegment[2]; // segment returned by getActiveSegment() or -1
+	char matchingSegment[2]; // segment with highest full activity or -1
+	uchar matchingActivity[2];
+} SegmentScore;
+
+// Per-timestep data is stored in two slots that swap roles every step, so stepping forwards in time
+// only needs to overwrite the slot that becomes NOW instead of copying everything into WAS.
 typedef struct
 {
 	global Cell* cells;
-	global Segment* segments;
-	global Synapse* synapses;
+	global uint* cellStates; // 2 slots * CELL_STATE_COUNT planes * cellStateWords() words
+	global Segment* segments; // segment pool
+	global SegmentActivity* segmentActivity; // 2 slots per pooled segment
+	global Synapse* synapses; // SEGMENT_SYNAPSE_COUNT synapses per pooled segment
+	global SegmentScore* scores;
+	global int* cellSegments; // CELL_SEGMENT_COUNT pool indices per cell
+	global int* pool; // see PoolHeader
+	global uint* dirtyBlocks; // one bit per SNAPSHOT_BLOCK_SIZE pooled segments whose synapses changed since the last snapshot
+	global uchar* cellOutputs; // one bit per CellState and cell, set by the current phase, see publishCellStates
+	uint step;
 } State;
 
-State makeState(global Cell* cells, global Segment* segments, global Synapse* synapses)
+State makeState(
+	global Cell* cells,
+	global uint* cellStates,
+	global Segment* segments,
+	global SegmentActivity* segmentActivity,
+	global Synapse* synapses,
+	global SegmentScore* scores,
+	global int* cellSegments,
+	global int* pool,
+	global uint* dirtyBlocks,
+	global uchar* cellOutputs,
+	uint step)
 {
 	State ret;
 	ret.cells = cells;
+	ret.cellStates = cellStates;
 	ret.segments = segments;
+	ret.segmentActivity = segmentActivity;
 	ret.synapses = synapses;
+	ret.scores = scores;
+	ret.cellSegments = cellSegments;
+	ret.pool = pool;
+	ret.dirtyBlocks = dirtyBlocks;
+	ret.cellOutputs = cellOutputs;
+	ret.step = step;
 	return ret;
 }
 
+inline int columnCount()
+{
+	return REGION_WIDTH * REGION_HEIGHT * REGION_DEPTH;
+}
+inline int cellStateWords()
+{
+	return (columnCount() * COLUMN_CELL_COUNT + 31) / 32;
+}
+inline int timeSlot(const State* state, TimeStep when)
+{
+	return (state->step ^ when) & 1;
+}
+
 inline global Cell* getCells(const State* state, int columnIdx)
 {
 	return &state->cells[columnIdx * COLUMN_CELL_COUNT];
 }
-inline global Segment* getSegments(const State* state, int columnIdx, int cellIdx)
+inline global SegmentScore* getScore(const State* state, int columnIdx, int cellIdx)
+{
+	return &state->scores[columnIdx * COLUMN_CELL_COUNT + cellIdx];
+}
+inline global int* getCellSegments(const State* state, int columnIdx, int cellIdx)
+{
+	return &state->cellSegments[(columnIdx * COLUMN_CELL_COUNT + cellIdx) * CELL_SEGMENT_COUNT];
+}
+inline global Segment* getSegment(const State* state, int columnIdx, int cellIdx, int segmentIdx)
 {
-	return &state->segments[
-	columnIdx * CELL_SEGMENT_COUNT * COLUMN_CELL_COUNT
-	+ cellIdx * CELL_SEGMENT_COUNT];
+	return &state->segments[getCellSegments(state, columnIdx, cellIdx)[segmentIdx]];
 }
 inline global Synapse* getSynapses(const State* state, int columnIdx, int cellIdx, int segmentIdx)
 {
-	return &state->synapses[
-	columnIdx * SEGMENT_SYNAPSE_COUNT * CELL_SEGMENT_COUNT * COLUMN_CELL_COUNT
-	+ cellIdx * SEGMENT_SYNAPSE_COUNT * CELL_SEGMENT_COUNT
-	+ segmentIdx * SEGMENT_SYNAPSE_COUNT
-	];
+	return &state->synapses[getCellSegments(state, columnIdx, cellIdx)[segmentIdx] * SEGMENT_SYNAPSE_COUNT];
+}
+
+// Record that the synapses of a pooled segment changed, so the next snapshot copies their block
+inline void markSynapsesDirty(const State* state, int poolIdx)
+{
+	int block = poolIdx / SNAPSHOT_BLOCK_SIZE;
+	uint bit = 1u << (block % 32);
+	if (!(state->dirtyBlocks[block / 32] & bit))
+		atomic_or(&state->dirtyBlocks[block / 32], bit);
 }
 
-inline bool getCellState(uchar state, TimeStep when, uchar stateMask)
+inline global uint* getStatePlane(const State* state, TimeStep when, CellState plane)
+{
+	return &state->cellStates[(timeSlot(state, when) * CELL_STATE_COUNT + plane) * cellStateWords()];
+}
+// Bits of a state plane word that belong to the cells of one column
+inline uint columnMask(int columnIdx, int word)
 {
-	return state & (stateMask << (when*4));
+	int lo = max(columnIdx * COLUMN_CELL_COUNT - word * 32, 0);
+	int hi = min(columnIdx * COLUMN_CELL_COUNT + COLUMN_CELL_COUNT - word * 32, 32);
+	if (hi <= lo)
+		return 0;
+	uint bits = (hi - lo == 32) ? 0xFFFFFFFFu : ((1u << (hi - lo)) - 1);
+	return bits << lo;
 }
-inline void setCellState(global Cell* cell, uchar stateMask)
+inline bool getCellState(const State* state, int targetCell, TimeStep when, CellState plane)
 {
-	cell->state |= stateMask;
+	return (getStatePlane(state, when, plane)[targetCell / 32] >> (targetCell % 32)) & 1;
+}
+inline bool getColumnCellState(const State* state, int columnIdx, int cellIdx, TimeStep when, CellState plane)
+{
+	return getCellState(state, columnIdx * COLUMN_CELL_COUNT + cellIdx, when, plane);
+}
+// Cells of neighbouring columns share plane words, so a phase only sets the output of its own cells and
+// publishCellStates packs them into the NOW planes once every column is done
+inline void setCellState(const State* state, int columnIdx, int cellIdx, CellState plane)
+{
+	state->cellOutputs[columnIdx * COLUMN_CELL_COUNT + cellIdx] |= 1u << plane;
 }
 
-uint random(uint2* seedValue)
+inline bool hasFlag(global Segment* segment, SegmentFlag flag)
+{
+	return segment->flags & flag;
+}
+inline void setFlag(global Segment* segment, SegmentFlag flag, bool value)
 {
-	uint seed = (seedValue->x++) + get_global_id(0);
-	uint t = seed ^ (seed << 11);
-	return seedValue->y ^ (seedValue->y >> 19) ^ (t ^ (t >> 8));
+	if (value)
+		segment->flags |= flag;
+	else
+		segment->flags &= ~flag;
 }
 
-inline bool segmentActivity(global Segment* segment, TimeStep when, CellState state)
+inline global SegmentActivity* getSegmentActivity(const State* state, global Segment* segment, TimeStep when)
 {
-	if (state == ACTIVESTATE)
-		return segment->activity[0][when];
-	if (state == LEARNSTATE)
-		return segment->activity[1][when];
-	return 0;
+	return &state->segmentActivity[(segment - state->segments) * 2 + timeSlot(state, when)];
+}
+inline int segmentActivity(const State* state, global Segment* segment, TimeStep when, SegmentCounter counter)
+{
+	SegmentActivity packed = *getSegmentActivity(state, segment, when);
+	return (packed >> (counter * SEGMENT_COUNTER_BITS)) & ((1 << SEGMENT_COUNTER_BITS) - 1);
 }
-inline bool segmentActive(global Segment* segment, TimeStep when, CellState state)
+inline void setSegmentActivity(const State* state, global Segment* segment, TimeStep when, int active, int learn, int fullActive)
 {
-	return segmentActivity(segment, when, state) > SEGMENT_ACTIVATION_THRESHOLD;
+	*getSegmentActivity(state, segment, when) =
+		((SegmentActivity)active << (ACTIVE_COUNTER * SEGMENT_COUNTER_BITS)) |
+		((SegmentActivity)learn << (LEARN_COUNTER * SEGMENT_COUNTER_BITS)) |
+		((SegmentActivity)fullActive << (FULL_ACTIVE_COUNTER * SEGMENT_COUNTER_BITS));
 }
-void resetSynapse(const State* state, global Synapse* synapse, bool connectToLearningCell, TimeStep learningCellWhen, uint2* randomState)
+inline bool segmentActive(const State* state, global Segment* segment, TimeStep when, SegmentCounter counter)
+{
+	return segmentActivity(state, segment, when, counter) > SEGMENT_ACTIVATION_THRESHOLD;
+}
+
+void resetSynapse(const State* state, int columnIdx, global Synapse* synapse, bool connectToLearningCell, TimeStep learningCellWhen, RandomStream* rng)
 {
 	// If we fail to connect to a learning cell, fallback to a randomly selected cell
 	if (connectToLearningCell)
 	{
-		int randOffset = random(randomState) % get_global_size(0);
+		// Scan the learn plane a word at a time, starting from a random word
+		global uint* learning = getStatePlane(state, learningCellWhen, LEARNSTATE);
+		int wordCount = cellStateWords();
+		int randOffset = random(rng) % wordCount;
 
-		int targetColumn = -1;
-		int targetCell = -1;
-		int columnCount = get_global_size(0);
-		for (int i = 0; i < columnCount; ++i)
+		for (int i = 0; i < wordCount; ++i)
 		{
-			int testColumnId = (randOffset+i) % get_global_size(0);
-
-			global Cell* testColumn = getCells(state, testColumnId);
-
-			if (testColumnId == get_global_id(0)) // Skip self...
-				continue;
-
-			for (int a = 0; a < COLUMN_CELL_COUNT; ++a)
+			int w = (randOffset+i) % wordCount;
+			uint bits = learning[w] & ~columnMask(columnIdx, w); // Skip self...
+			if (bits)
 			{
-				global Cell* testCell = testColumn + a;
-				if (getCellState(testCell->state, learningCellWhen, LEARNSTATE))
-				{
-					// Found one!
-					targetColumn = testColumnId;
-					targetCell = a;
-					break;
-				}
+				// Found one!
+				synapse->targetCell = w * 32 + (31 - clz(bits & (~bits + 1)));
+				synapse->permanence = CONNECTED_PERMANENCE*2;
+				synapse->permanenceQueued = synapse->permanence;
+				return;
 			}
-			if (targetColumn != -1)
-				break;
-		}
-
-		// Check if we found a cell
-		if (targetColumn != -1)
-		{
-			synapse->targetColumn = targetColumn;
-			synapse->targetCell = targetCell;
-			synapse->permanence = CONNECTED_PERMANENCE*2;
-			synapse->targetCellState = 0;
-			return;
 		}
 	}
 
 	// Pick random column, skip self
-	int targetColumn = random(randomState) % (get_global_size(0)-1);
-	if (targetColumn >= get_global_id(0))
+	int targetColumn = random(rng) % (columnCount()-1);
+	if (targetColumn >= columnIdx)
 		targetColumn++;
 	// Pick random cell
-	int targetCell = random(randomState) % COLUMN_CELL_COUNT;
+	int targetCell = random(rng) % COLUMN_CELL_COUNT;
 
-	synapse->targetColumn = targetColumn;
-	synapse->targetCell = targetCell;
+	synapse->targetCell = targetColumn * COLUMN_CELL_COUNT + targetCell;
 	synapse->permanence = CONNECTED_PERMANENCE*2;
-	synapse->targetCellState = 0;
+	synapse->permanenceQueued = synapse->permanence;
+}
+
+// Take a segment from the pool, or return -1 if it is exhausted
+int allocateSegment(const State* state)
+{
+	global int* pool = state->pool;
+
+	// Reuse segments released by compactSegments first. Nothing is pushed to the free stack while
+	// the learning kernels run, so a pop that finds the stack empty can simply be undone.
+	int freeIdx = atomic_dec(&pool[POOL_FREE_COUNT]) - 1;
+	if (freeIdx >= 0)
+		return pool[POOL_HEADER_SIZE + freeIdx];
+	atomic_inc(&pool[POOL_FREE_COUNT]);
+
+	int poolIdx = atomic_inc(&pool[POOL_TOP]);
+	if (poolIdx < pool[POOL_CAPACITY])
+		return poolIdx;
+
+	// The host grows the pool when it notices failed allocations
+	atomic_inc(&pool[POOL_FAILED]);
+	return -1;
 }
 
-global Segment* getActiveSegment(const State* state, int columnIdx, int cellIdx, TimeStep when, CellState cellState)
+// Append an empty segment to a cell. Returns its index within the cell or -1 if the cell or the pool is full.
+int addSegment(const State* state, int columnIdx, int cellIdx)
 {
 	global Cell* cell = getCells(state, columnIdx) + cellIdx;
-	global Segment* segments = getSegments(state, columnIdx, cellIdx);
+	if (cell->segmentCount >= CELL_SEGMENT_COUNT)
+		return -1;
 
-	bool activeSequenceSegments = false;
-	for (int i = 0; i < CELL_SEGMENT_COUNT; ++i)
-	{
-		global Segment* seg = segments + i;
-		if (seg->sequenceSegment && segmentActive(seg, when, cellState))
-		{
-			activeSequenceSegments = true;
-			break;
-		}
-	}
+	int poolIdx = allocateSegment(state);
+	if (poolIdx == -1)
+		return -1;
+
+	int segmentIdx = cell->segmentCount++;
+	getCellSegments(state, columnIdx, cellIdx)[segmentIdx] = poolIdx;
+
+	global Segment* segment = &state->segments[poolIdx];
+	setSegmentActivity(state, segment, NOW, 0, 0, 0);
+	setSegmentActivity(state, segment, WAS, 0, 0, 0);
+	segment->synapseCount = 0;
+	segment->flags = 0;
+	segment->activeDutyCycle = 1.0f; // New segments get a grace period before compaction may release them
+
+	return segmentIdx;
+}
 
+// Find the active, best active and best matching segments of a cell in a single pass and cache them
+// for the given timestep. Everything else reads the cached results instead of rescanning the segments.
+void scoreSegments(const State* state, int columnIdx, int cellIdx, TimeStep when)
+{
+	global Cell* cell = getCells(state, columnIdx) + cellIdx;
+	global int* cellSegments = getCellSegments(state, columnIdx, cellIdx);
+	global SegmentScore* score = getScore(state, columnIdx, cellIdx);
+	int slot = timeSlot(state, when);
+
+	bool activeSequenceSegments = false;
 	int bestActivityIdx = -1;
 	int bestActivity = -1;
+	int bestSequenceActivityIdx = -1;
+	int bestSequenceActivity = -1;
+	int bestMatchingIdx = -1;
+	int bestMatching = 0;
 
-	for (int i = 0; i < CELL_SEGMENT_COUNT; ++i)
+	for (int i = 0; i < cell->segmentCount; ++i)
 	{
-		global Segment* seg = segments + i;
-		if (activeSequenceSegments && !seg->sequenceSegment)
-			continue;
+		global Segment* seg = &state->segments[cellSegments[i]];
+		int act = segmentActivity(state, seg, when, ACTIVE_COUNTER);
+		bool sequenceSegment = hasFlag(seg, SEGMENT_SEQUENCE);
 
-		int act = segmentActivity(seg, when, cellState);
-		if (act > SEGMENT_MIN_THRESHOLD && act > bestActivity)
+		// Sequence segments take precedence if any of them is active
+		if (sequenceSegment && act > SEGMENT_ACTIVATION_THRESHOLD)
+			activeSequenceSegments = true;
+
+		if (act > SEGMENT_MIN_THRESHOLD)
+		{
+			if (act > bestActivity)
+			{
+				bestActivity = act;
+				bestActivityIdx = i;
+			}
+			if (sequenceSegment && act > bestSequenceActivity)
+			{
+				bestSequenceActivity = act;
+				bestSequenceActivityIdx = i;
+			}
+		}
+
+		// Check synapses that are not even fully connected
+		int fullAct = segmentActivity(state, seg, when, FULL_ACTIVE_COUNTER);
+		if (fullAct > bestMatching || bestMatchingIdx == -1)
 		{
-			bestActivity = act;
-			bestActivityIdx = i;
+			bestMatching = fullAct;
+			bestMatchingIdx = i;
 		}
 	}
-	if (bestActivityIdx != -1)
-		return segments + bestActivityIdx;
+
+	score->activeSegment[slot] = activeSequenceSegments ? bestSequenceActivityIdx : bestActivityIdx;
+	score->matchingSegment[slot] = bestMatchingIdx;
+	score->matchingActivity[slot] = bestMatching;
+}
+
+global Segment* getActiveSegment(const State* state, int columnIdx, int cellIdx, TimeStep when)
+{
+	int idx = getScore(state, columnIdx, cellIdx)->activeSegment[timeSlot(state, when)];
+	if (idx != -1)
+		return getSegment(state, columnIdx, cellIdx, idx);
 	return 0;
 }
 
@@ -206,35 +372,14 @@ typedef struct
 
 BestMatchingSegmentStruct getBestMatchingSegment(const State* state, int columnIdx, int cellIdx, TimeStep when)
 {
-	global Cell* cell = getCells(state, columnIdx) + cellIdx;
+	global SegmentScore* score = getScore(state, columnIdx, cellIdx);
 	BestMatchingSegmentStruct ret;
-	ret.activity = 0;
+	ret.activity = score->matchingActivity[timeSlot(state, when)];
+	ret.segmentIdx = score->matchingSegment[timeSlot(state, when)];
 	ret.segment = 0;
-	ret.segmentIdx = -1;
-
-	int bestActivityIdx = -1;
-	int bestActivity = 0;
-
-	// Return segment with highest activity
-
-	global Segment* segments = getSegments(state, columnIdx, cellIdx);
-	for (int i = 0; i < CELL_SEGMENT_COUNT; ++i)
-	{
-		global Segment* seg = segments + i;
-
-		// Check synapses that are not even fully connected
-		int activity = seg->fullActivity[ACTIVESTATE][when];
-
-		if (activity > bestActivity || i == 0)
-		{
-			bestActivity = activity;
-			bestActivityIdx = i;
-		}
-	}
-	ret.activity = bestActivity;
-	ret.segment = segments + bestActivityIdx;
-	ret.segmentIdx = bestActivityIdx;
-	return  ret;
+	if (ret.segmentIdx != -1)
+		ret.segment = getSegment(state, columnIdx, cellIdx, ret.segmentIdx);
+	return ret;
 }
 
 typedef struct
@@ -243,6 +388,7 @@ typedef struct
 	int cellIdx;
 	global Segment* segment;
 	int segmentIdx;
+	int activity;
 } BestMatchingCellStruct;
 
 BestMatchingCellStruct getBestMatchingCell(const State* state, int columnIdx, TimeStep when)
@@ -253,29 +399,42 @@ BestMatchingCellStruct getBestMatchingCell(const State* state, int columnIdx, Ti
 	ret.segment = 0;
 	ret.cellIdx = -1;
 	ret.segmentIdx = -1;
+	ret.activity = 0;
 
-	int bestActivityIdx = -1;
-	int bestActivity = 0;
-
-	// Return cell and segment with highest activity
+	// Return cell and segment with highest activity. On a tie prefer the cell with fewest segments,
+	// so new segments spread over the column.
 	for (int i = 0; i < COLUMN_CELL_COUNT; ++i)
 	{
 		global Cell* cell = cells + i;
 		BestMatchingSegmentStruct bestSegment =
 			getBestMatchingSegment(state, columnIdx, i, when);
 
-		if (bestSegment.activity > bestActivity || i == 0)
+		if (i == 0
+			|| bestSegment.activity > ret.activity
+			|| (bestSegment.activity == ret.activity && cell->segmentCount < ret.cell->segmentCount))
 		{
-			bestActivity = bestSegment.activity;
 			ret.cell = cell;
 			ret.cellIdx = i;
 			ret.segment = bestSegment.segment;
 			ret.segmentIdx = bestSegment.segmentIdx;
+			ret.activity = bestSegment.activity;
 		}
 	}
 	return ret;
 }
 
+// Segment that learning should reinforce: the best matching one, or a new one if none matches well enough
+int getLearningSegment(const State* state, int columnIdx, int cellIdx, int matchingSegmentIdx, int matchingActivity)
+{
+	if (matchingSegmentIdx == -1 || matchingActivity < SEGMENT_MIN_THRESHOLD)
+	{
+		int newSegmentIdx = addSegment(state, columnIdx, cellIdx);
+		if (newSegmentIdx != -1)
+			return newSegmentIdx;
+	}
+	return matchingSegmentIdx;
+}
+
 void getSegmentActiveSynapses(
 	const State* state,
 	int columnIdx,
@@ -283,30 +442,31 @@ void getSegmentActiveSynapses(
 	int segmentIdx,
 	TimeStep when,
 	bool newSynapses,
-	uint2* randomState
+	RandomStream* rng
 	)
 {
-	global Segment* segment = getSegments(state, columnIdx, cellIdx) + segmentIdx;
+	global Segment* segment = getSegment(state, columnIdx, cellIdx, segmentIdx);
 	global Synapse* synapses = getSynapses(state, columnIdx, cellIdx, segmentIdx);
+	int synapseCount = segment->synapseCount;
+	markSynapsesDirty(state, getCellSegments(state, columnIdx, cellIdx)[segmentIdx]);
 
 	// If no changes have been queued, set permamenceQueued of each synapse to match current permanence
-	bool hasChanges = segment->hasQueuedChanges;
-	if (!hasChanges)
+	if (!hasFlag(segment, SEGMENT_QUEUED_CHANGES))
 	{
-		for (int i = 0 ; i < SEGMENT_SYNAPSE_COUNT; ++i)
+		for (int i = 0 ; i < synapseCount; ++i)
 		{
 			global Synapse* synapse = synapses + i;
 			synapse->permanenceQueued = synapse->permanence;
 		}
-		segment->sequenceSegmentQueued = segment->sequenceSegment;
-		segment->hasQueuedChanges = true;
+		setFlag(segment, SEGMENT_SEQUENCE_QUEUED, hasFlag(segment, SEGMENT_SEQUENCE));
+		setFlag(segment, SEGMENT_QUEUED_CHANGES, true);
 	}
 
 	// Find active synapses in segment
-	for (int i = 0 ; i < SEGMENT_SYNAPSE_COUNT; ++i)
+	for (int i = 0 ; i < synapseCount; ++i)
 	{
 		global Synapse* synapse = synapses + i;
-		if (getCellState(synapse->targetCellState, when, ACTIVESTATE))
+		if (getCellState(state, synapse->targetCell, when, ACTIVESTATE))
 		{
 			synapse->permanenceQueued += PERMANENCE_STEP;
 		}
@@ -319,38 +479,55 @@ void getSegmentActiveSynapses(
 	// Enhance segment by connecting some of the worst synapses to learning cells
 	if (newSynapses)
 	{
+		int resetCount = 0;
+
 		// For each bad synapse...
-		for (int b = 0; b < SEGMENT_SYNAPSE_COUNT; ++b)
+		for (int b = 0; b < synapseCount; ++b)
 		{
 			global Synapse* synapse = synapses + b;
 
 			if (synapse->permanence > CONNECTED_PERMANENCE / 2.0f)
 				continue;
 
-			resetSynapse(state, synapse, true, when, randomState);
+			resetSynapse(state, columnIdx, synapse, true, when, rng);
+			resetCount++;
 		}
+
+		// ...and grow the segment towards its capacity
+		int newSynapseCount = min(SEGMENT_SYNAPSE_COUNT, synapseCount + SEGMENT_NEW_SYNAPSE_COUNT);
+		for (int b = synapseCount; b < newSynapseCount; ++b)
+		{
+			resetSynapse(state, columnIdx, synapses + b, true, when, rng);
+		}
+		segment->synapseCount = newSynapseCount;
+
+		resetCount += newSynapseCount - synapseCount;
+		if (resetCount > 0)
+			atomic_add(&state->pool[POOL_SYNAPSES_RESET], resetCount);
 	}
 }
 
 void adaptSegments(const State* state, int columnIdx, int cellIdx, bool positiveReinforcement)
 {
 	global Cell* cell = getCells(state, columnIdx) + cellIdx;
-	global Segment* segments = getSegments(state, columnIdx, cellIdx);
+	int adaptedCount = 0;
 
-	for (int i = 0; i < CELL_SEGMENT_COUNT; ++i)
+	for (int i = 0; i < cell->segmentCount; ++i)
 	{
-		global Segment* segment = segments + i;
+		global Segment* segment = getSegment(state, columnIdx, cellIdx, i);
 		global Synapse* synapses = getSynapses(state, columnIdx, cellIdx, i);
 
-		if (!segment->hasQueuedChanges)
+		if (!hasFlag(segment, SEGMENT_QUEUED_CHANGES))
 			continue;
-		segment->hasQueuedChanges = false;
-		segment->sequenceSegment = segment->sequenceSegmentQueued;
+		adaptedCount++;
+		setFlag(segment, SEGMENT_QUEUED_CHANGES, false);
+		setFlag(segment, SEGMENT_SEQUENCE, hasFlag(segment, SEGMENT_SEQUENCE_QUEUED));
+		markSynapsesDirty(state, getCellSegments(state, columnIdx, cellIdx)[i]);
 
 		if (positiveReinforcement)
 		{
 			// Cool, use the enhanced values of all synapses
-			for (int a = 0; a < SEGMENT_SYNAPSE_COUNT; ++a)
+			for (int a = 0; a < segment->synapseCount; ++a)
 			{
 				global Synapse* synapse = synapses + a;
 				synapse->permanence = synapse->permanenceQueued;
@@ -359,7 +536,7 @@ void adaptSegments(const State* state, int columnIdx, int cellIdx, bool positive
 		else
 		{
 			// Oops, misprediction. Synapses that had their permanence enhanced are flipped, the rest stay untouched
-			for (int a = 0; a < SEGMENT_SYNAPSE_COUNT; ++a)
+			for (int a = 0; a < segment->synapseCount; ++a)
 			{
 				global Synapse* synapse = synapses + a;
 				if (synapse->permanenceQueued > synapse->permanence)
@@ -368,7 +545,7 @@ void adaptSegments(const State* state, int columnIdx, int cellIdx, bool positive
 				}
 			}
 		}
-		for (int a = 0; a < SEGMENT_SYNAPSE_COUNT; ++a)
+		for (int a = 0; a < segment->synapseCount; ++a)
 		{
 			global Synapse* synapse = synapses + a;
 			if (synapse->permanence > 1.0f)
@@ -377,132 +554,136 @@ void adaptSegments(const State* state, int columnIdx, int cellIdx, bool positive
 				synapse->permanence = 0.0f;
 		}
 	}
+	if (adaptedCount > 0)
+		atomic_add(&state->pool[POOL_SEGMENTS_ADAPTED], adaptedCount);
 }
 
 
 
+
+
+
 void kernel initRegion(
 	global Cell* g_cells,
+	global uint* g_cellStates,
 	global Segment* g_segments,
+	global SegmentActivity* g_segmentActivity,
 	global Synapse* g_synapses,
-	uint2 randomState)
+	global SegmentScore* g_scores,
+	global int* g_cellSegments,
+	global int* g_pool,
+	global uint* g_dirtyBlocks,
+	global uchar* g_cellOutputs,
+	uint step)
 {
-	State state = makeState(g_cells, g_segments, g_synapses);
+	State state = makeState(g_cells, g_cellStates, g_segments, g_segmentActivity, g_synapses, g_scores, g_cellSegments, g_pool, g_dirtyBlocks, g_cellOutputs, step);
 	int columnIdx = get_global_id(0);
 
 	// Get cells of the current column
 	global Cell* cells = getCells(&state, columnIdx);
 
+	// Cell states of both slots, including the padding bits past the last cell, are zeroed by the host
+
+	// Cells start without segments, they are allocated from the pool as the region learns
 	for (int i = 0 ; i < COLUMN_CELL_COUNT; ++i)
 	{
 		global Cell* cell = cells + i;
-		cell->state = 0;
+		cell->segmentCount = 0;
 
-		global Segment* segments = getSegments(&state, columnIdx, i);
-		for (int a = 0; a < CELL_SEGMENT_COUNT; ++a)
+		global SegmentScore* score = getScore(&state, columnIdx, i);
+		for (int slot = 0; slot < 2; ++slot)
 		{
-			global Segment* segment = segments + a;
-			segment->activity[0][WAS] = 0;
-			segment->activity[1][WAS] = 0;
-			segment->activity[0][NOW] = 0;
-			segment->activity[1][NOW] = 0;
-			segment->fullActivity[0][WAS] = 0;
-			segment->fullActivity[1][WAS] = 0;
-			segment->fullActivity[0][NOW] = 0;
-			segment->fullActivity[1][NOW] = 0;
-			segment->sequenceSegment = false;
-			segment->sequenceSegmentQueued = false;
-			segment->hasQueuedChanges = false;
-			segment->activeDutyCycle = 0;
-
-			global Synapse* synapses = getSynapses(&state, columnIdx, i, a);
-			for (int b = 0; b < SEGMENT_SYNAPSE_COUNT; ++b)
-			{
-				resetSynapse(&state, synapses+b, false, NOW, &randomState);
-			}
+			score->activeSegment[slot] = -1;
+			score->matchingSegment[slot] = -1;
+			score->matchingActivity[slot] = 0;
 		}
 	}
 }
 
-void kernel timeStep(
+// Pack the cell outputs of the phase before into the NOW planes given by the bits of planes, one word per
+// work-item. Every word is overwritten, so the slot that became NOW needs no clearing. Phases only read
+// published planes, which no launch writes to while it reads them.
+void kernel publishCellStates(
 	global Cell* g_cells,
+	global uint* g_cellStates,
 	global Segment* g_segments,
-	global Synapse* g_synapses)
+	global SegmentActivity* g_segmentActivity,
+	global Synapse* g_synapses,
+	global SegmentScore* g_scores,
+	global int* g_cellSegments,
+	global int* g_pool,
+	global uint* g_dirtyBlocks,
+	global uchar* g_cellOutputs,
+	uint planes,
+	uint step)
 {
-	State state = makeState(g_cells, g_segments, g_synapses);
-	int columnIdx = get_global_id(0);
-
-	// Get cells of the current column
-	global Cell* cells = getCells(&state, columnIdx);
+	State state = makeState(g_cells, g_cellStates, g_segments, g_segmentActivity, g_synapses, g_scores, g_cellSegments, g_pool, g_dirtyBlocks, g_cellOutputs, step);
+	int word = get_global_id(0);
+	int firstCell = word * 32;
+	int cellCount = min(32, columnCount() * COLUMN_CELL_COUNT - firstCell);
 
-	for (int i = 0 ; i < COLUMN_CELL_COUNT; ++i)
+	for (int plane = 0; plane < CELL_STATE_COUNT; ++plane)
 	{
-		global Cell* cell = cells + i;
-		cell->state = (cell->state << 4) & 0xF0;
-
-		global Segment* segments = getSegments(&state, columnIdx, i);
-		for (int a = 0; a < CELL_SEGMENT_COUNT; ++a)
-		{
-			global Segment* segment = segments + a;
-			segment->activity[0][WAS] = segment->activity[0][NOW];
-			segment->activity[1][WAS] = segment->activity[1][NOW];
-			segment->activity[0][NOW] = 0;
-			segment->activity[1][NOW] = 0;
-			segment->fullActivity[0][WAS] = segment->fullActivity[0][NOW];
-			segment->fullActivity[1][WAS] = segment->fullActivity[1][NOW];
-			segment->fullActivity[0][NOW] = 0;
-			segment->fullActivity[1][NOW] = 0;
+		if (!(planes & (1u << plane)))
+			continue;
 
-			global Synapse* synapses = getSynapses(&state, columnIdx, i, a);
-			for (int b = 0; b < SEGMENT_SYNAPSE_COUNT; ++b)
-			{
-				global Synapse* synapse = synapses + b;
-				synapse->targetCellState = synapse->targetCellState << 4;
-			}
-		}
+		uint bits = 0;
+		for (int i = 0; i < cellCount; ++i)
+			bits |= ((state.cellOutputs[firstCell + i] >> plane) & 1u) << i;
+		getStatePlane(&state, NOW, plane)[word] = bits;
 	}
 }
 
 void kernel computeActiveState(
 	global Cell* g_cells,
+	global uint* g_cellStates,
 	global Segment* g_segments,
+	global SegmentActivity* g_segmentActivity,
 	global Synapse* g_synapses,
+	global SegmentScore* g_scores,
+	global int* g_cellSegments,
+	global int* g_pool,
+	global uint* g_dirtyBlocks,
+	global uchar* g_cellOutputs,
 	global const char* activeColumns,
-	uint2 randomState)
+	uint2 randomKey,
+	uint step,
+	uint learn) // whether segments are queued for learning on this step, see CLArgs::LearningInterval
 {
-	State state = makeState(g_cells, g_segments, g_synapses);
+	State state = makeState(g_cells, g_cellStates, g_segments, g_segmentActivity, g_synapses, g_scores, g_cellSegments, g_pool, g_dirtyBlocks, g_cellOutputs, step);
 	int columnIdx = get_global_id(0);
+	RandomStream rng = makeRandomStream(randomKey, step, columnIdx, RANDOM_STREAM_TEMPORAL_ACTIVE);
+
+	// Outputs of the previous step are published, start over
+	for (int i = 0 ; i < COLUMN_CELL_COUNT; ++i)
+		state.cellOutputs[columnIdx * COLUMN_CELL_COUNT + i] = 0;
 
 	if (!activeColumns[columnIdx])
 		return;
 
-	global Cell* cells = getCells(&state, columnIdx);
-
 	bool buPredicted = false;
 	bool lcChosen = false;
 
 	// Check if any cell predicted this column activation
 	for (int i = 0 ; i < COLUMN_CELL_COUNT; ++i)
 	{
-		global Cell* cell = cells + i;
-
-		if (getCellState(cell->state, WAS, PREDICTIVESTATE))
+		if (getColumnCellState(&state, columnIdx, i, WAS, PREDICTIVESTATE))
 		{
-			global Segment* segment = getActiveSegment(&state, columnIdx, i, WAS, ACTIVESTATE);
+			global Segment* segment = getActiveSegment(&state, columnIdx, i, WAS);
 			if (!segment)
 			{
 				// We shouldn't end up here...
 				return;
 			}
-			if (segment->sequenceSegment)
+			if (hasFlag(segment, SEGMENT_SEQUENCE))
 			{
 				buPredicted = true;
 
-				setCellState(cell, ACTIVESTATE);
-				if (segmentActive(segment, WAS, LEARNSTATE))
+				setCellState(&state, columnIdx, i, ACTIVESTATE);
+				if (segmentActive(&state, segment, WAS, LEARN_COUNTER))
 				{
 					lcChosen = true;
-					setCellState(cell, LEARNSTATE);
+					setCellState(&state, columnIdx, i, LEARNSTATE);
 				}
 			}
 		}
@@ -511,137 +692,235 @@ void kernel computeActiveState(
 	if (!buPredicted)
 	{
 		// Bottom-up input was unexpected -> activate all cells
-		global Cell* cells = getCells(&state, columnIdx);
 		for (int i = 0 ; i < COLUMN_CELL_COUNT; ++i)
 		{
-			global Cell* cell = cells + i;
-			setCellState(cell, ACTIVESTATE);
+			setCellState(&state, columnIdx, i, ACTIVESTATE);
 		}
 	}
 	if (!lcChosen)
 	{
 		BestMatchingCellStruct ret = getBestMatchingCell(&state, columnIdx, WAS);
-		global Cell* learnCell = ret.cell;
 		int learnCellIdx = ret.cellIdx;
-		global Segment* learnSegment = ret.segment;
-		int learnSegmentIdx = ret.segmentIdx;
-		setCellState(learnCell, LEARNSTATE);
+		setCellState(&state, columnIdx, learnCellIdx, LEARNSTATE);
 
-		getSegmentActiveSynapses(&state, columnIdx, learnCellIdx, learnSegmentIdx, WAS, true, &randomState);
-		learnSegment->sequenceSegmentQueued = true;
+		int learnSegmentIdx = learn ? getLearningSegment(&state, columnIdx, learnCellIdx, ret.segmentIdx, ret.activity) : -1;
+		if (learnSegmentIdx != -1)
+		{
+			getSegmentActiveSynapses(&state, columnIdx, learnCellIdx, learnSegmentIdx, WAS, true, &rng);
+			setFlag(getSegment(&state, columnIdx, learnCellIdx, learnSegmentIdx), SEGMENT_SEQUENCE_QUEUED, true);
+		}
 	}
 }
 
 void kernel computePredictiveState(
 	global Cell* g_cells,
+	global uint* g_cellStates,
 	global Segment* g_segments,
+	global SegmentActivity* g_segmentActivity,
 	global Synapse* g_synapses,
+	global SegmentScore* g_scores,
+	global int* g_cellSegments,
+	global int* g_pool,
+	global uint* g_dirtyBlocks,
+	global uchar* g_cellOutputs,
 	global const char* activeColumns,
-	uint2 randomState)
+	uint2 randomKey,
+	uint step,
+	uint learn) // whether segments are queued for learning on this step, see CLArgs::LearningInterval
 {
-	State state = makeState(g_cells, g_segments, g_synapses);
+	State state = makeState(g_cells, g_cellStates, g_segments, g_segmentActivity, g_synapses, g_scores, g_cellSegments, g_pool, g_dirtyBlocks, g_cellOutputs, step);
 
 	int columnIdx = get_global_id(0);
+	RandomStream rng = makeRandomStream(randomKey, step, columnIdx, RANDOM_STREAM_TEMPORAL_PREDICTIVE);
 	global Cell* cells = getCells(&state, columnIdx);
 
+	// Active and learn planes are published by now, the predictive state goes to the cell outputs
+	global const uint* activePlane = getStatePlane(&state, NOW, ACTIVESTATE);
+	global const uint* learnPlane = getStatePlane(&state, NOW, LEARNSTATE);
+
 	for (int i = 0 ; i < COLUMN_CELL_COUNT; ++i)
 	{
 		global Cell* cell = cells + i;
-		global Segment* segments = getSegments(&state, columnIdx, i);
+		bool predicted = false;
 
-		for (int a = 0 ; a < CELL_SEGMENT_COUNT; ++a)
+		for (int a = 0 ; a < cell->segmentCount; ++a)
 		{
-			global Segment* segment = segments + a;
+			global Segment* segment = getSegment(&state, columnIdx, i, a);
 
 			// Cache segment activity here..
 			int activity = 0;
 			int fullActivity = 0;
 			int learnActivity = 0;
-			int fullLearnActivity = 0;
 			global Synapse* synapses = getSynapses(&state, columnIdx, i, a);
-			for (int b = 0 ; b < SEGMENT_SYNAPSE_COUNT; ++b)
+			for (int b = 0 ; b < segment->synapseCount; ++b)
 			{
 				global Synapse* syn = synapses + b;
+				int word = syn->targetCell / 32;
+				uint bit = 1u << (syn->targetCell % 32);
+				bool connected = syn->permanence > CONNECTED_PERMANENCE;
 
-				global Cell* targetCell = getCells(&state, syn->targetColumn) + syn->targetCell;
-
-				syn->targetCellState |= targetCell->state & 0xF;
-
-				if (getCellState(targetCell->state, NOW, ACTIVESTATE))
+				if (activePlane[word] & bit)
 				{
 					fullActivity++;
-					if (syn->permanence > CONNECTED_PERMANENCE)
+					if (connected)
 						activity++;
 				}
-				if (getCellState(targetCell->state, NOW, LEARNSTATE))
-				{
-					fullLearnActivity++;
-					if (syn->permanence > CONNECTED_PERMANENCE)
-						learnActivity++;
-				}
+				if ((learnPlane[word] & bit) && connected)
+					learnActivity++;
 			}
-			segment->activity[0][NOW] = activity;
-			segment->fullActivity[0][NOW] = fullActivity;
-			segment->activity[1][NOW] = learnActivity;
-			segment->fullActivity[1][NOW] = fullLearnActivity;
-
-//			if (segmentActive(segment, NOW, ACTIVESTATE))
-//			if (segmentActivity(segment, NOW, ACTIVESTATE) > SEGMENT_ACTIVATION_THRESHOLD)
-			if (segment->activity[0][NOW] > SEGMENT_ACTIVATION_THRESHOLD)
-			{
-				setCellState(cell, PREDICTIVESTATE);
+			setSegmentActivity(&state, segment, NOW, activity, learnActivity, fullActivity);
 
-				getSegmentActiveSynapses(&state, columnIdx, i, a, NOW, false, &randomState);
+			if (activity > SEGMENT_ACTIVATION_THRESHOLD)
+			{
+				setCellState(&state, columnIdx, i, PREDICTIVESTATE);
+				predicted = true;
 
-				BestMatchingSegmentStruct bestMatch = getBestMatchingSegment(&state, columnIdx, i, WAS);
-				getSegmentActiveSynapses(&state, columnIdx, i, bestMatch.segmentIdx, WAS, true, &randomState);
+				if (learn)
+					getSegmentActiveSynapses(&state, columnIdx, i, a, NOW, false, &rng);
 			}
 		}
+
+		// Previous timestep's best match is the same for every predicting segment, so queue it once per cell
+		if (predicted && learn)
+		{
+			BestMatchingSegmentStruct bestMatch = getBestMatchingSegment(&state, columnIdx, i, WAS);
+			int learnSegmentIdx = getLearningSegment(&state, columnIdx, i, bestMatch.segmentIdx, bestMatch.activity);
+			if (learnSegmentIdx != -1)
+				getSegmentActiveSynapses(&state, columnIdx, i, learnSegmentIdx, WAS, true, &rng);
+		}
 	}
 }
 void kernel updateSynapses(
 	global Cell* g_cells,
+	global uint* g_cellStates,
 	global Segment* g_segments,
+	global SegmentActivity* g_segmentActivity,
 	global Synapse* g_synapses,
-	global char* resultBuffer)
+	global SegmentScore* g_scores,
+	global int* g_cellSegments,
+	global int* g_pool,
+	global uint* g_dirtyBlocks,
+	global uchar* g_cellOutputs,
+	global char* resultBuffer,
+	global int* anomaly,
+	uint step)
 {
-	State state = makeState(g_cells, g_segments, g_synapses);
+	State state = makeState(g_cells, g_cellStates, g_segments, g_segmentActivity, g_synapses, g_scores, g_cellSegments, g_pool, g_dirtyBlocks, g_cellOutputs, step);
 	int columnIdx = get_global_id(0);
 	global char* result = resultBuffer + columnIdx;
 
+	// resultBuffer still holds the active columns of this step until it is overwritten below
+	bool inputActive = *result;
+	bool wasPredicted = false;
+
 	bool columnActive = false;
 
 	global Cell* cells = getCells(&state, columnIdx);
 	for (int i = 0 ; i < COLUMN_CELL_COUNT; ++i)
 	{
 		global Cell* cell = cells + i;
-		if (getCellState(cell->state, NOW, LEARNSTATE))
+		bool active = getColumnCellState(&state, columnIdx, i, NOW, ACTIVESTATE);
+		bool predictive = getColumnCellState(&state, columnIdx, i, NOW, PREDICTIVESTATE);
+
+		if (getColumnCellState(&state, columnIdx, i, NOW, LEARNSTATE))
 		{
 			adaptSegments(&state, columnIdx, i, true);
 		}
-		else if(!getCellState(cell->state, NOW, PREDICTIVESTATE) && getCellState(cell->state, WAS, PREDICTIVESTATE))
+		else if(!predictive && getColumnCellState(&state, columnIdx, i, WAS, PREDICTIVESTATE))
 		{
 			adaptSegments(&state, columnIdx, i, false);
 		}
 
 		// Update segment duty cycles
-		if (getCellState(cell->state, NOW, ACTIVESTATE))
+		if (active)
 		{
-			global Segment* segments = getSegments(&state, columnIdx, i);
-			for (int a = 0; a < CELL_SEGMENT_COUNT; ++a)
+			for (int a = 0; a < cell->segmentCount; ++a)
 			{
-				global Segment* segment = segments+a;
-				bool active = segmentActive(segment, NOW, ACTIVESTATE);
+				global Segment* segment = getSegment(&state, columnIdx, i, a);
+				bool segmentIsActive = segmentActive(&state, segment, NOW, ACTIVE_COUNTER);
 
 				const float persistence = 0.95f;
 				segment->activeDutyCycle *= persistence;
-				segment->activeDutyCycle += active * (1.0f - persistence);
+				segment->activeDutyCycle += segmentIsActive * (1.0f - persistence);
 			}
 		}
-		if (getCellState(cell->state, NOW, ACTIVESTATE|PREDICTIVESTATE))
+		if (active || predictive)
 		{
 			columnActive = true;
 		}
+		if (getColumnCellState(&state, columnIdx, i, WAS, PREDICTIVESTATE))
+		{
+			wasPredicted = true;
+		}
+
+		// Segments won't change until next step, so score them now for the phases that follow
+		scoreSegments(&state, columnIdx, i, NOW);
 	}
 	*result = columnActive;
+
+	if (inputActive)
+	{
+		atomic_inc(&anomaly[ANOMALY_ACTIVE_COLUMNS]);
+		if (!wasPredicted)
+			atomic_inc(&anomaly[ANOMALY_UNPREDICTED_COLUMNS]);
+	}
+}
+
+// Release segments that stopped contributing back to the pool and squeeze the per-cell segment lists and
+// per-segment synapse lists, so that scans only touch what the region has actually learned.
+// Runs between steps, after updateSynapses.
+void kernel compactSegments(
+	global Cell* g_cells,
+	global uint* g_cellStates,
+	global Segment* g_segments,
+	global SegmentActivity* g_segmentActivity,
+	global Synapse* g_synapses,
+	global SegmentScore* g_scores,
+	global int* g_cellSegments,
+	global int* g_pool,
+	global uint* g_dirtyBlocks,
+	global uchar* g_cellOutputs,
+	uint step)
+{
+	State state = makeState(g_cells, g_cellStates, g_segments, g_segmentActivity, g_synapses, g_scores, g_cellSegments, g_pool, g_dirtyBlocks, g_cellOutputs, step);
+	int columnIdx = get_global_id(0);
+
+	global Cell* cells = getCells(&state, columnIdx);
+	for (int i = 0 ; i < COLUMN_CELL_COUNT; ++i)
+	{
+		global Cell* cell = cells + i;
+		global int* cellSegments = getCellSegments(&state, columnIdx, i);
+
+		int keptSegments = 0;
+		for (int a = 0; a < cell->segmentCount; ++a)
+		{
+			int poolIdx = cellSegments[a];
+			global Segment* segment = &state.segments[poolIdx];
+			global Synapse* synapses = &state.synapses[poolIdx * SEGMENT_SYNAPSE_COUNT];
+
+			// Drop synapses that have decayed completely
+			int keptSynapses = 0;
+			for (int b = 0; b < segment->synapseCount; ++b)
+			{
+				if (synapses[b].permanence > 0.0f)
+					synapses[keptSynapses++] = synapses[b];
+			}
+			if (keptSynapses != segment->synapseCount)
+				markSynapsesDirty(&state, poolIdx);
+			segment->synapseCount = keptSynapses;
+
+			bool dead = keptSynapses == 0 || segment->activeDutyCycle < SEGMENT_MIN_DUTY_CYCLE;
+			if (dead && !hasFlag(segment, SEGMENT_QUEUED_CHANGES))
+			{
+				int freeIdx = atomic_inc(&state.pool[POOL_FREE_COUNT]);
+				state.pool[POOL_HEADER_SIZE + freeIdx] = poolIdx;
+				continue;
+			}
+			cellSegments[keptSegments++] = poolIdx;
+		}
+		cell->segmentCount = keptSegments;
+
+		// Segment indices moved, refresh the cached search results
+		scoreSegments(&state, columnIdx, i, NOW);
+	}
 }
@@ -0,0 +1,64 @@
+#include "clanomaly.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+CLAnomalyLikelihood::CLAnomalyLikelihood(int averagingWindow, int historySize)
+	: m_averagingWindow(averagingWindow)
+	, m_historySize(historySize)
+	, m_scores(averagingWindow, 0)
+	, m_averages(historySize, 0)
+	, m_steps(0)
+	, m_scoreSum(0)
+	, m_averageSum(0)
+	, m_averageSquareSum(0)
+{
+	if (averagingWindow <= 0 || historySize <= 1)
+		throw std::runtime_error("Invalid anomaly likelihood window!");
+}
+
+double CLAnomalyLikelihood::update(double anomalyScore)
+{
+	// Running sums are updated by swapping the oldest entry of each ring buffer for the newest
+	double& oldScore = m_scores[std::size_t(m_steps % m_averagingWindow)];
+	m_scoreSum += anomalyScore - oldScore;
+	oldScore = anomalyScore;
+
+	double average = m_scoreSum / double(std::min<std::uint64_t>(m_steps + 1, m_averagingWindow));
+
+	double& oldAverage = m_averages[std::size_t(m_steps % m_historySize)];
+	m_averageSum += average - oldAverage;
+	m_averageSquareSum += average * average - oldAverage * oldAverage;
+	oldAverage = average;
+
+	m_steps++;
+	if (m_steps % m_averagingWindow == 0)
+	{
+		// Resum once per window so that rounding errors do not pile up
+		m_scoreSum = 0;
+		for (double s: m_scores)
+			m_scoreSum += s;
+	}
+	if (m_steps % m_historySize == 0)
+	{
+		m_averageSum = 0;
+		m_averageSquareSum = 0;
+		for (double a: m_averages)
+		{
+			m_averageSum += a;
+			m_averageSquareSum += a * a;
+		}
+	}
+	if (m_steps < std::uint64_t(m_historySize))
+		return 0.5;
+
+	// Model the short-term average as normally distributed and return its cumulative probability
+	const double minDeviation = 0.01; // a region that never changes would otherwise flag any noise
+	double mean = m_averageSum / m_historySize;
+	double variance = std::max(m_averageSquareSum / m_historySize - mean * mean, 0.0);
+	double deviation = std::max(std::sqrt(variance), minDeviation);
+
+	double z = (average - mean) / deviation;
+	return 0.5 * std::erfc(-z / std::sqrt(2.0));
+}
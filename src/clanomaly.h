@@ -0,0 +1,32 @@
+#ifndef CLANOMALY_H_INCLUDED
+#define CLANOMALY_H_INCLUDED
+
+#include <vector>
+#include <cstdint>
+
+// Rolling anomaly likelihood over the per-step anomaly scores of a region. A short-term average of the
+// scores is compared to the distribution of that average over a longer history, so a region that is
+// always somewhat surprised does not raise alarms while a sudden change in surprise does.
+class CLAnomalyLikelihood
+{
+private:
+	int m_averagingWindow;
+	int m_historySize;
+
+	std::vector<double> m_scores; // last m_averagingWindow scores, ring buffer
+	std::vector<double> m_averages; // last m_historySize short-term averages, ring buffer
+	std::uint64_t m_steps;
+	double m_scoreSum;
+	double m_averageSum;
+	double m_averageSquareSum;
+
+public:
+
+	CLAnomalyLikelihood(int averagingWindow = 10, int historySize = 1000);
+
+	// Add the score of a step and return the probability that the recent scores are anomalous.
+	// Returns 0.5 until the history has filled up.
+	double update(double anomalyScore);
+};
+
+#endif
@@ -1,5 +1,35 @@
 #include "clargs.h"
+#include "clrandom.h"
 #include <sstream>
+#include <algorithm>
+
+int CLArgs::segmentCounterBits() const
+{
+	int bits = 1;
+	while ((1 << bits) <= SegmentSynapseCount)
+		bits++;
+	return bits;
+}
+int CLArgs::segmentActivitySize() const
+{
+	// Three counters: active, learn and full active
+	return segmentCounterBits() * 3 <= 16 ? 2 : 4;
+}
+
+bool CLArgs::learnsAt(std::uint32_t step) const
+{
+	if (LearningInterval <= 1)
+		return true;
+	if (!StochasticLearning)
+		return step % LearningInterval == 0;
+	return CLRandom(RandomSeed, step, 0, RANDOM_STREAM_LEARNING).next() % LearningInterval == 0;
+}
+float CLArgs::learningPermanenceStep() const
+{
+	if (!LearningRateCompensation || LearningInterval <= 1)
+		return PermanenceStep;
+	return std::min(PermanenceStep * LearningInterval, 1.0f);
+}
 
 std::string CLArgs::serialize() const
 {
@@ -11,13 +41,19 @@ std::string CLArgs::serialize() const
 	<< "constant float BOOST_STEP = "                        << BoostStep                       << ";"
 	<< "constant float DUTY_CYCLE_PERSISTENCE = "            << DutyCyclePersistence            << ";"
 	<< "constant float SPARSITY_TARGET = "                   << SparsityTarget                  << ";"
+	<< "constant float MIN_DUTY_CYCLE_FRACTION = "           << MinDutyCycleFraction            << ";"
 	<< "constant int COLUMN_CELL_COUNT = "                   << ColumnCellCount                 << ";"
 	<< "constant int CELL_SEGMENT_COUNT = "                  << CellSegmentCount                << ";"
 	<< "constant int SEGMENT_SYNAPSE_COUNT = "               << SegmentSynapseCount             << ";"
+	<< "constant int SEGMENT_NEW_SYNAPSE_COUNT = "           << SegmentNewSynapseCount          << ";"
 	<< "constant int SEGMENT_ACTIVATION_THRESHOLD = "        << SegmentActivationThreshold      << ";"
 	<< "constant int SEGMENT_MIN_THRESHOLD = "               << SegmentMinThreshold             << ";"
+	<< "constant float SEGMENT_MIN_DUTY_CYCLE = "            << SegmentMinDutyCycle             << ";"
 	<< "constant float CONNECTED_PERMANENCE = "              << ConnectedPermanence             << ";"
-	<< "constant float PERMANENCE_STEP = "                   << PermanenceStep                  << ";";
+	<< "constant float PERMANENCE_STEP = "                   << learningPermanenceStep()        << ";"
+	<< "constant int SNAPSHOT_BLOCK_SIZE = "                 << SnapshotBlockSize               << ";"
+	<< "constant int SEGMENT_COUNTER_BITS = "                << segmentCounterBits()            << ";"
+	<< "typedef "  << (segmentActivitySize() == 2 ? "ushort" : "uint") << " SegmentActivity;";
 
 	return constants.str();
 }
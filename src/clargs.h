@@ -2,25 +2,78 @@
 #define CLARGS_H_INCLUDED
 
 #include <string>
+#include <cstdint>
 
 struct CLArgs
 {
 	float ConnectedPermanence = 0.2;
 	float PermanenceStep = 0.05;
 
+	// Learn on one step in LearningInterval only, the steps in between just infer. This keeps up with input rates
+	// that full learning can not. Strided learning learns on every LearningInterval-th step, stochastic learning
+	// picks steps at random with the same rate. With LearningRateCompensation the permanence step is scaled by
+	// the interval, so the region adapts about as fast per input as it would learning on every step.
+	// Duty cycles and boosts follow every step either way.
+	int LearningInterval = 1;
+	bool StochasticLearning = false;
+	bool LearningRateCompensation = true;
+
+	// Key of the counter-based generator used by all kernels. Runs with the same seed are identical.
+	std::uint64_t RandomSeed = 1;
+
 	// Spatial pooler:
 	int ColumnProximalSynapseCount = 10;
 	int ColumnProximalSynapseMinOverlap = 7;
 	float BoostStep = 0.01;
 	float DutyCyclePersistence = 0.99;
 	float SparsityTarget = 0.04; // Percentage
+	float MinDutyCycleFraction = 0.01; // Columns below this fraction of the highest duty cycle in their neighbourhood are boosted
+
+	// Every RefineInterval steps (0 = never) the next RefineSliceSize columns are checked and starving columns or
+	// columns with a fully decayed synapse get their weakest synapse reset. A slice size of 0 means 1% of the
+	// columns, which with an interval of 1 visits every column once per 100 steps.
+	int RefineInterval = 1;
+	int RefineSliceSize = 0;
+
+	// Adapt the inhibition radius to the average connected receptive field every InhibitionRadiusInterval steps,
+	// starting from CLTopology::inhibitionRadius. Global inhibition turns local once the receptive fields are known.
+	bool AdaptiveInhibitionRadius = false;
+	int InhibitionRadiusInterval = 100;
 
 	// Temporal pooler:
 	int ColumnCellCount = 4;
-	int CellSegmentCount = 10;
-	int SegmentSynapseCount = 10;
+	int CellSegmentCount = 10; // Maximum segments per cell
+	int SegmentSynapseCount = 10; // Maximum synapses per segment
+	int SegmentNewSynapseCount = 6; // Synapses a segment grows by when it learns
 	int SegmentActivationThreshold = 5;
 	int SegmentMinThreshold = 3;
+	float SegmentMinDutyCycle = 0.001; // Segments less active than this are returned to the pool
+
+	// Segments are allocated from a pool that starts at SegmentPoolSize (0 = one segment per cell) and
+	// grows towards CellSegmentCount segments per cell. Compaction releases dead segments and grows the pool.
+	int SegmentPoolSize = 0;
+	int SegmentCompactionInterval = 100; // Steps between compactions, 0 disables compaction and growth
+	// Upper bound of the pool growth, 0 = CellSegmentCount segments per cell. CLRegion lowers it further if growing
+	// the pool would not fit into DeviceMemoryBudget of the device's global memory, less what other regions on
+	// contexts forked from the same context have reserved.
+	int SegmentPoolLimit = 0;
+	float DeviceMemoryBudget = 0.9;
+
+	// Synapses are tracked for incremental snapshots in blocks of this many columns (spatial pooler) or
+	// pooled segments (temporal pooler). Smaller blocks make deltas tighter but the dirty bitmaps larger.
+	int SnapshotBlockSize = 64;
+
+	// Record the device time of every kernel launch in the region's CLMetrics. Profiling queues can be slower.
+	bool KernelProfiling = false;
+
+	// Segment activity counters are packed into one word per segment and timestep, sized for SegmentSynapseCount
+	int segmentCounterBits() const;
+	int segmentActivitySize() const; // bytes
+
+	// Whether the poolers learn on the given step, see LearningInterval
+	bool learnsAt(std::uint32_t step) const;
+	// Permanence change per learning step
+	float learningPermanenceStep() const;
 
 	std::string serialize() const;
 };
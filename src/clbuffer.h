@@ -2,6 +2,7 @@
 #define CLBUFFER_H_INCLUDED
 
 #include "clcontext.h"
+#include <algorithm>
 #include <cassert>
 #include <vector>
 
@@ -33,8 +34,23 @@ public:
 	void enqueueWrite(bool blocking, const std::vector<T>& data)
 	{
 		assert(data.size() == m_data.size());
-		assert(data.size() * sizeof(T) == m_byteSize);
-		m_context.queue().enqueueWriteBuffer(m_buffer, blocking ? CL_TRUE : CL_FALSE, 0, m_byteSize, &data[0]);
+		enqueueWrite(blocking, &data[0]);
+	}
+	// Write size() elements from external memory, which must stay valid until the write completes
+	void enqueueWrite(bool blocking, const T* data)
+	{
+		m_context.metrics().add(CLMetrics::BYTES_UPLOADED, m_byteSize);
+		m_context.barrier();
+		m_context.queue().enqueueWriteBuffer(m_buffer, blocking ? CL_TRUE : CL_FALSE, 0, m_byteSize, data);
+	}
+	// Write the host copy without blocking. It must not change until the returned event completes.
+	cl::Event enqueueWriteAsync()
+	{
+		cl::Event event;
+		m_context.metrics().add(CLMetrics::BYTES_UPLOADED, m_byteSize);
+		m_context.barrier();
+		m_context.queue().enqueueWriteBuffer(m_buffer, CL_FALSE, 0, m_byteSize, &m_data[0], nullptr, &event);
+		return event;
 	}
 	// Read data from device
 	void enqueueRead(bool blocking)
@@ -45,8 +61,43 @@ public:
 	void enqueueRead(bool blocking, std::vector<T>& data)
 	{
 		assert(data.size() == m_data.size());
-		assert(data.size() * sizeof(T) == m_byteSize);
-		m_context.queue().enqueueReadBuffer(m_buffer, blocking ? CL_TRUE : CL_FALSE, 0, m_byteSize, &data[0]);
+		enqueueRead(blocking, &data[0]);
+	}
+	// Read size() elements into external memory
+	void enqueueRead(bool blocking, T* data)
+	{
+		m_context.metrics().add(CLMetrics::BYTES_DOWNLOADED, m_byteSize);
+		m_context.barrier();
+		m_context.queue().enqueueReadBuffer(m_buffer, blocking ? CL_TRUE : CL_FALSE, 0, m_byteSize, data);
+	}
+
+	// Write a range of elements to the device
+	void enqueueWrite(bool blocking, std::size_t offset, std::size_t length)
+	{
+		assert(offset + length <= m_data.size());
+		m_context.metrics().add(CLMetrics::BYTES_UPLOADED, length * sizeof(T));
+		m_context.barrier();
+		m_context.queue().enqueueWriteBuffer(m_buffer, blocking ? CL_TRUE : CL_FALSE, offset * sizeof(T), length * sizeof(T), &m_data[offset]);
+	}
+	// Read a range of elements from the device
+	void enqueueRead(bool blocking, std::size_t offset, std::size_t length)
+	{
+		assert(offset + length <= m_data.size());
+		m_context.metrics().add(CLMetrics::BYTES_DOWNLOADED, length * sizeof(T));
+		m_context.barrier();
+		m_context.queue().enqueueReadBuffer(m_buffer, blocking ? CL_TRUE : CL_FALSE, offset * sizeof(T), length * sizeof(T), &m_data[offset]);
+	}
+
+	// Reallocate the device buffer. Contents are kept up to the smaller of the two lengths.
+	void resize(std::size_t length)
+	{
+		std::size_t byteSize = length * sizeof(T);
+		cl::Buffer buffer(m_context.nativeContext(), CL_MEM_READ_WRITE, byteSize);
+		m_context.barrier();
+		m_context.queue().enqueueCopyBuffer(m_buffer, buffer, 0, 0, std::min(byteSize, m_byteSize));
+		m_buffer = buffer;
+		m_data.resize(length);
+		m_byteSize = byteSize;
 	}
 
 	// Define some accessors to the underlying std::vector
@@ -58,6 +109,7 @@ public:
 		return m_data[index];
 	}
 	inline std::size_t size() const { return m_data.size(); }
+	inline std::size_t byteSize() const { return m_byteSize; }
 };
 
 #endif
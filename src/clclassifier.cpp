@@ -0,0 +1,98 @@
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <sstream>
+
+#include "clclassifier.h"
+#include "cltemporal.h"
+#include "clspecialization.h"
+
+constexpr static const char* CLASSIFIER_SRC =
+#include "classifier.cl.h"
+;
+
+CLClassifier::CLClassifier(CLContext& context, const CLTopology& topo, const CLArgs& args, const std::vector<int>& steps, int bucketCount, float learningRate)
+	: m_context(context)
+	, m_topology(topo)
+	, m_args(args)
+	, m_steps(steps)
+	, m_bucketCount(bucketCount)
+	, m_learningRate(learningRate)
+	, m_patternWords((m_topology.getColumns() * args.ColumnCellCount + 31) / 32)
+	, m_weightData(context, steps.size() * m_topology.getColumns() * args.ColumnCellCount * bucketCount)
+	, m_historyData(context, (steps.empty() ? 1 : *std::max_element(steps.begin(), steps.end()) + 1) * m_patternWords)
+	, m_stepData(context, steps.size())
+	, m_probabilityData(context, steps.size() * bucketCount)
+	, m_step(0)
+{
+	if (steps.empty() || bucketCount <= 0 || *std::min_element(steps.begin(), steps.end()) <= 0)
+	{
+		throw std::runtime_error("Invalid classifier steps or bucket count!");
+	}
+
+	std::stringstream constants; constants
+	<< "constant int CLASSIFIER_STEP_COUNT = "   << steps.size()                         << ";"
+	<< "constant int CLASSIFIER_BUCKET_COUNT = " << bucketCount                          << ";"
+	<< "constant int CLASSIFIER_HISTORY = "      << m_historyData.size() / m_patternWords << ";";
+
+	std::string definitions = args.serialize() + topo.serialize() + constants.str();
+	cl::Program program = context.buildProgram({definitions, "\n#line 1\n", CLASSIFIER_SRC}, CLSpecialization(context.device(), args).buildOptions());
+
+	m_recordPatternKernel = CLKernel(program, "recordPattern");
+	m_recordPatternKernel.setRange(cl::NDRange(m_patternWords));
+	m_recordPatternKernel.setArg(3, m_historyData.buffer());
+	m_computeActivationsKernel = CLKernel(program, "computeActivations");
+	m_computeActivationsKernel.setRange(cl::NDRange(bucketCount, steps.size()));
+	m_computeActivationsKernel.bind(m_weightData.buffer(), m_historyData.buffer(), m_stepData.buffer(), m_probabilityData.buffer());
+	m_softmaxKernel = CLKernel(program, "softmax");
+	m_softmaxKernel.setRange(cl::NDRange(steps.size()));
+	m_softmaxKernel.bind(m_probabilityData.buffer());
+	m_learnKernel = CLKernel(program, "learn");
+	m_learnKernel.setRange(cl::NDRange(m_patternWords, steps.size()));
+	m_learnKernel.bind(m_weightData.buffer(), m_historyData.buffer(), m_stepData.buffer(), m_probabilityData.buffer());
+	m_learnKernel.setArg(5, m_learningRate);
+
+	// Start from uniform predictions
+	std::fill(m_weightData.begin(), m_weightData.end(), 0.0f);
+	m_weightData.enqueueWrite(false);
+	std::copy(steps.begin(), steps.end(), m_stepData.begin());
+	m_stepData.enqueueWrite(false);
+}
+
+void CLClassifier::write(CLTemporalPooler& pooler, int actualBucket, std::vector<float>& probabilities)
+{
+	if (actualBucket >= m_bucketCount)
+	{
+		throw std::runtime_error("Invalid bucket!");
+	}
+
+	m_step++;
+	std::vector<cl::Event> done(1);
+	m_recordPatternKernel.setArg(RECORD_CELL_STATES_ARG, pooler.cellStateBuffer());
+	m_recordPatternKernel.setArg(RECORD_ACTIVE_OFFSET_ARG, pooler.cellStatePlaneOffset(CLTemporalPooler::CELL_STATE_ACTIVE));
+	m_recordPatternKernel.setArg(RECORD_PREDICTIVE_OFFSET_ARG, pooler.cellStatePlaneOffset(CLTemporalPooler::CELL_STATE_PREDICTIVE));
+	m_recordPatternKernel.setArg(RECORD_STEP_ARG, m_step);
+	done[0] = m_recordPatternKernel.launch(m_context);
+	m_computeActivationsKernel.setArg(ACTIVATIONS_STEP_ARG, m_step);
+
+	// Learning needs the patterns of every step count to be recorded
+	int history = m_historyData.size() / m_patternWords;
+	if (actualBucket >= 0 && m_step >= cl_uint(history))
+	{
+		m_computeActivationsKernel.setArg(ACTIVATIONS_LEARN_ARG, 1);
+		done[0] = m_computeActivationsKernel.launch(m_context, &done);
+		done[0] = m_softmaxKernel.launch(m_context, &done);
+		m_learnKernel.setArg(LEARN_BUCKET_ARG, actualBucket);
+		m_learnKernel.setArg(LEARN_STEP_ARG, m_step);
+		done[0] = m_learnKernel.launch(m_context, &done);
+	}
+
+	// Predict from the pattern of this step
+	m_computeActivationsKernel.setArg(ACTIVATIONS_LEARN_ARG, 0);
+	done[0] = m_computeActivationsKernel.launch(m_context, &done);
+	m_softmaxKernel.launch(m_context, &done);
+
+	probabilities.resize(m_probabilityData.size());
+	m_probabilityData.enqueueRead(true, probabilities);
+	m_context.recordLaunches();
+}
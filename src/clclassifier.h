@@ -0,0 +1,65 @@
+#ifndef CLCLASSIFIER_H_INCLUDED
+#define CLCLASSIFIER_H_INCLUDED
+
+#include <vector>
+#include "clcontext.h"
+#include "clbuffer.h"
+#include "cltopology.h"
+#include "clargs.h"
+#include "clkernel.h"
+
+class CLTemporalPooler;
+
+// Predicts which value bucket the input will fall in a number of steps ahead, from the cells that are
+// active or predictive now. Runs on the device, reading cell states straight from the temporal pooler.
+// One softmax layer per step count, trained online; weights of a cell are only updated when it is in a pattern.
+// Construct it with the context of the region it reads from, so that both share a command queue.
+class CLClassifier
+{
+private:
+	CLContext& m_context;
+
+	const CLTopology m_topology;
+	const CLArgs m_args;
+
+	std::vector<int> m_steps;
+	int m_bucketCount;
+	float m_learningRate;
+	int m_patternWords;
+
+	CLKernel m_recordPatternKernel;
+	CLKernel m_computeActivationsKernel;
+	CLKernel m_softmaxKernel;
+	CLKernel m_learnKernel;
+
+	// Arguments that change between launches
+	enum
+	{
+		RECORD_CELL_STATES_ARG = 0,
+		RECORD_ACTIVE_OFFSET_ARG = 1,
+		RECORD_PREDICTIVE_OFFSET_ARG = 2,
+		RECORD_STEP_ARG = 4,
+		ACTIVATIONS_STEP_ARG = 4,
+		ACTIVATIONS_LEARN_ARG = 5,
+		LEARN_BUCKET_ARG = 4,
+		LEARN_STEP_ARG = 6
+	};
+
+	CLBuffer<cl_float> m_weightData;
+	CLBuffer<cl_uint> m_historyData; // patterns of the last max(steps) + 1 steps
+	CLBuffer<cl_int> m_stepData;
+	CLBuffer<cl_float> m_probabilityData;
+
+	cl_uint m_step;
+
+public:
+
+	// steps lists how many steps ahead to predict, bucketCount the number of value buckets
+	CLClassifier(CLContext& context, const CLTopology& topo, const CLArgs& args, const std::vector<int>& steps, int bucketCount, float learningRate = 0.001f);
+
+	// Record the pattern of the step the pooler just computed, learn that it was followed by actualBucket
+	// (-1 to only predict) and return probabilities for steps.size() * bucketCount (step count, bucket) pairs.
+	void write(CLTemporalPooler& pooler, int actualBucket, std::vector<float>& probabilities);
+};
+
+#endif
@@ -1,20 +1,133 @@
 #include "clcontext.h"
+#include <iostream>
 #include <stdexcept>
+#include <mutex>
+#include <map>
+
+class CLProgramCache
+{
+public:
+	std::mutex mutex;
+	std::map<std::string, cl::Program> programs; // by build options and sources
+};
+
+static cl_command_queue_properties queueProperties(const cl::Device& device, bool profiling)
+{
+	cl_command_queue_properties properties = profiling ? CL_QUEUE_PROFILING_ENABLE : 0;
+	if (device.getInfo<CL_DEVICE_QUEUE_PROPERTIES>() & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)
+		properties |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+	return properties;
+}
+
+class CLDeviceMemory
+{
+public:
+	std::mutex mutex;
+	std::size_t reserved = 0;
+};
 
 CLContext::CLContext()
+	: CLContext(0, 0)
+{
+}
+
+CLContext::CLContext(std::size_t platformIndex, std::size_t deviceIndex)
+	: m_programs(std::make_shared<CLProgramCache>())
+	, m_memory(std::make_shared<CLDeviceMemory>())
+	, m_metrics(std::make_shared<CLMetrics>(false))
+	, m_outOfOrder(false)
 {
 	std::vector< cl::Platform > platformList;
 	cl::Platform::get(&platformList);
 	if (platformList.empty())
 		throw std::runtime_error("No OpenCL platforms available");
+	if (platformIndex >= platformList.size())
+		throw std::runtime_error("No OpenCL platform with that index");
 
-	auto& defaultPlatform = platformList.front();
+	auto& platform = platformList[platformIndex];
 	std::vector< cl::Device > deviceList;
-	defaultPlatform.getDevices(CL_DEVICE_TYPE_ALL, &deviceList);
+	platform.getDevices(CL_DEVICE_TYPE_ALL, &deviceList);
 	if (deviceList.empty())
 		throw std::runtime_error("OpenCL platform contains no devices");
+	if (deviceIndex >= deviceList.size())
+		throw std::runtime_error("OpenCL platform contains no device with that index");
+
+	m_device = deviceList[deviceIndex];
+	m_context = cl::Context(m_device);
+	cl_command_queue_properties properties = queueProperties(m_device, false);
+	m_queue = cl::CommandQueue(m_context, m_device, properties);
+	m_outOfOrder = (properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0;
+}
 
-	m_device = deviceList.front();
-	m_context = cl::Context({m_device});
-	m_queue = cl::CommandQueue(m_context, m_device);
+CLContext::CLContext(const cl::Device& device, const cl::Context& context, const std::shared_ptr<CLProgramCache>& programs,
+	const std::shared_ptr<CLDeviceMemory>& memory, bool profiling)
+	: m_device(device)
+	, m_context(context)
+	, m_queue(context, device, queueProperties(device, profiling))
+	, m_programs(programs)
+	, m_memory(memory)
+	, m_metrics(std::make_shared<CLMetrics>(profiling))
+	, m_outOfOrder((queueProperties(device, profiling) & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0)
+{
+}
+
+std::unique_ptr<CLContext> CLContext::fork(bool profiling) const
+{
+	return std::unique_ptr<CLContext>(new CLContext(m_device, m_context, m_programs, m_memory, profiling));
+}
+
+cl::Program CLContext::buildProgram(const std::vector<std::string>& sources, const std::string& options)
+{
+	std::string key = options;
+	for (const std::string& source : sources)
+	{
+		key += '\0';
+		key += source;
+	}
+
+	// Held while building, so regions constructed in parallel wait for one build instead of compiling twice
+	std::lock_guard<std::mutex> lock(m_programs->mutex);
+	auto found = m_programs->programs.find(key);
+	if (found != m_programs->programs.end())
+		return found->second;
+
+	cl::Program program(m_context, cl::Program::Sources(sources.begin(), sources.end()));
+	try
+	{
+		program.build({m_device}, options.c_str());
+	}
+	catch(const cl::Error& err)
+	{
+		std::cerr << "Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_device) << std::endl;
+		throw;
+	}
+
+	m_programs->programs[key] = program;
+	return program;
+}
+
+std::size_t CLContext::reserveDeviceMemory(std::size_t budget, const std::function<std::size_t(std::size_t available)>& choose)
+{
+	std::lock_guard<std::mutex> lock(m_memory->mutex);
+	std::size_t bytes = choose(budget > m_memory->reserved ? budget - m_memory->reserved : 0);
+	m_memory->reserved += bytes;
+	return bytes;
+}
+
+void CLContext::recordLaunches()
+{
+	for (auto& launch : m_launches)
+	{
+		cl_ulong time = 0;
+		if (m_metrics->profiling())
+			time = launch.second.getProfilingInfo<CL_PROFILING_COMMAND_END>() - launch.second.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		m_metrics->addKernelTime(launch.first, time);
+	}
+	m_launches.clear();
+}
+
+void CLContext::releaseDeviceMemory(std::size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_memory->mutex);
+	m_memory->reserved -= bytes;
 }
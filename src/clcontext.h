@@ -1,27 +1,81 @@
 #ifndef CLCONTEXT_H_DEFINED
 #define CLCONTEXT_H_DEFINED
 
-#define __CL_ENABLE_EXCEPTIONS
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
 
 #ifdef __APPLE__
 #include <OpenCL/opencl.hpp>
 #else
-#include <CL/cl.hpp>
+#include <CL/opencl.hpp>
 #endif
 
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+
+#include "clmetrics.h"
+
+class CLProgramCache;
+class CLDeviceMemory;
+
 class CLContext
 {
 private:
 	cl::Device m_device;
 	cl::Context m_context;
 	cl::CommandQueue m_queue;
+	std::shared_ptr<CLProgramCache> m_programs; // shared with forked contexts
+	std::shared_ptr<CLDeviceMemory> m_memory; // shared with forked contexts
+	std::shared_ptr<CLMetrics> m_metrics; // of the work submitted to m_queue
+	bool m_outOfOrder; // whether m_queue may run commands out of order
+	std::vector< std::pair<int, cl::Event> > m_launches; // by CLKernel::launch() and not yet counted in m_metrics
+
+	CLContext(const cl::Device& device, const cl::Context& context, const std::shared_ptr<CLProgramCache>& programs,
+		const std::shared_ptr<CLDeviceMemory>& memory, bool profiling);
 
 public:
 	CLContext();
+	// Context on the given device of the given platform, in the order OpenCL lists them
+	CLContext(std::size_t platformIndex, std::size_t deviceIndex);
+
+	// Context on the same device with a command queue of its own. Work submitted to different queues is
+	// ordered independently, so each thread or region can wait on its own work only. Each fork counts its
+	// work in metrics of its own, with profiling the queue also records kernel times.
+	std::unique_ptr<CLContext> fork(bool profiling = false) const;
+
+	// Program built from the concatenated sources with the given build options. Each combination is compiled
+	// once and then reused by this context and every context forked from it, so regions of the same
+	// configuration share one build. Kernel objects are not shared, callers create their own from the program.
+	cl::Program buildProgram(const std::vector<std::string>& sources, const std::string& options = "");
+
+	// Reserve device memory out of budget bytes of the device. choose gets the bytes of budget that this context and
+	// the contexts forked from it have not reserved yet and returns the bytes to reserve. Runs under a lock, so regions
+	// set up on different threads cannot count on the same memory. Contexts created separately do not see each other's reservations.
+	std::size_t reserveDeviceMemory(std::size_t budget, const std::function<std::size_t(std::size_t available)>& choose);
+	void releaseDeviceMemory(std::size_t bytes);
 
 	cl::Device& device() { return m_device; }
 	cl::Context& nativeContext() { return m_context; }
 	cl::CommandQueue& queue() { return m_queue; }
+
+	// Queues run out of order where the device supports it, so that launches of a CLStepGraph that do not depend
+	// on each other can overlap. Other work must not start before what was queued ahead of it, so CLBuffer
+	// transfers, CLKernel::launch() and CLStepGraph::run() start with a barrier.
+	void barrier()
+	{
+		if (m_outOfOrder)
+			m_queue.enqueueBarrierWithWaitList();
+	}
+	CLMetrics& metrics() { return *m_metrics; }
+
+	// Launches outside step graphs, like compaction or the kernels of classifiers and encoders, are counted once
+	// they completed: CLKernel::launch() adds them, recordLaunches() folds them into metrics() after a blocking read.
+	void addLaunch(int metricsId, const cl::Event& event) { m_launches.push_back(std::make_pair(metricsId, event)); }
+	void recordLaunches();
 };
 
 #endif
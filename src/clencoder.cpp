@@ -0,0 +1,207 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include "clencoder.h"
+
+constexpr static const char* ENCODER_SRC =
+#include "encoder.cl.h"
+;
+
+CLEncoder::CLEncoder(CLContext& context)
+	: m_context(context)
+	, m_size(0)
+	, m_valueCount(0)
+	, m_encodeSize(0)
+	, m_nextStaging(0)
+{
+	cl::Program program = context.buildProgram({ENCODER_SRC});
+	m_encodeKernel = CLKernel(program, "encodeFields");
+}
+
+CLEncoder::Field& CLEncoder::addField(FieldType type, int width, int height, int window)
+{
+	if (width <= 0 || height <= 0 || window <= 0 || window > width || (type == FIELD_LOCATION && window > height))
+	{
+		throw std::runtime_error("Invalid encoder field size!");
+	}
+
+	Field field;
+	field.type = type;
+	field.offset = m_size;
+	field.width = width;
+	field.height = height;
+	field.window = window;
+	field.period = 0;
+	field.minLatitude = field.maxLatitude = field.minLongitude = field.maxLongitude = 0;
+	m_fields.push_back(std::move(field));
+
+	m_size += width * height;
+	m_valueCount += type == FIELD_LOCATION ? 2 : 1;
+	return m_fields.back();
+}
+
+int CLEncoder::addScalar(int totalSize, int windowSize)
+{
+	Field& field = addField(FIELD_SCALAR, totalSize, 1, windowSize);
+	field.sensor.reset(new CLSensor(totalSize, windowSize));
+	return m_fields.size() - 1;
+}
+
+int CLEncoder::addCategory(int categoryCount, int windowSize)
+{
+	addField(FIELD_CATEGORY, categoryCount * windowSize, 1, windowSize);
+	return m_fields.size() - 1;
+}
+
+int CLEncoder::addPeriodic(int totalSize, int windowSize, double period)
+{
+	if (period <= 0)
+	{
+		throw std::runtime_error("Invalid encoder period!");
+	}
+	addField(FIELD_PERIODIC, totalSize, 1, windowSize).period = period;
+	return m_fields.size() - 1;
+}
+
+int CLEncoder::addLocation(int gridWidth, int gridHeight, int windowSize, double minLatitude, double maxLatitude, double minLongitude, double maxLongitude)
+{
+	if (maxLatitude <= minLatitude || maxLongitude <= minLongitude)
+	{
+		throw std::runtime_error("Invalid encoder bounds!");
+	}
+	Field& field = addField(FIELD_LOCATION, gridWidth, gridHeight, windowSize);
+	field.minLatitude = minLatitude;
+	field.maxLatitude = maxLatitude;
+	field.minLongitude = minLongitude;
+	field.maxLongitude = maxLongitude;
+	return m_fields.size() - 1;
+}
+
+CLSensor& CLEncoder::sensor(int field)
+{
+	if (m_fields[field].type != FIELD_SCALAR)
+	{
+		throw std::runtime_error("Encoder field is not a scalar!");
+	}
+	return *m_fields[field].sensor;
+}
+
+void CLEncoder::computeWindows(const double* values, cl_int* windows)
+{
+	// Window of size bits centered on position, kept inside [0, length)
+	auto clampedStart = [](double position, int size, int length)
+	{
+		return std::min(std::max(int(position) - size / 2, 0), length - size);
+	};
+
+	for (Field& field : m_fields)
+	{
+		cl_int* window = windows;
+		windows += WINDOW_WORDS;
+		window[WINDOW_OFFSET] = field.offset;
+		window[WINDOW_WIDTH] = field.width;
+		window[WINDOW_HEIGHT] = field.height;
+		window[WINDOW_START_X] = 0;
+		window[WINDOW_START_Y] = 0;
+		window[WINDOW_SIZE_X] = field.window;
+		window[WINDOW_SIZE_Y] = 1;
+
+		double value = *values++;
+		switch (field.type)
+		{
+			case FIELD_SCALAR:
+			{
+				// Nothing is set while the sensor is warming up
+				int start = field.sensor->observe(value);
+				window[WINDOW_START_X] = std::max(start, 0);
+				window[WINDOW_SIZE_X] = start < 0 ? 0 : field.window;
+				break;
+			}
+			case FIELD_CATEGORY:
+			{
+				int categories = field.width / field.window;
+				if (value < 0 || value >= categories)
+				{
+					throw std::runtime_error("Invalid category!");
+				}
+				window[WINDOW_START_X] = int(value) * field.window;
+				break;
+			}
+			case FIELD_PERIODIC:
+			{
+				double phase = std::fmod(value, field.period) / field.period;
+				if (phase < 0)
+					phase += 1;
+				int center = int(phase * field.width) % field.width;
+				window[WINDOW_START_X] = (center - field.window / 2 + field.width) % field.width;
+				break;
+			}
+			case FIELD_LOCATION:
+			{
+				double longitude = *values++;
+				double y = (value - field.minLatitude) / (field.maxLatitude - field.minLatitude) * field.height;
+				double x = (longitude - field.minLongitude) / (field.maxLongitude - field.minLongitude) * field.width;
+				window[WINDOW_START_X] = clampedStart(x, field.window, field.width);
+				window[WINDOW_START_Y] = clampedStart(y, field.window, field.height);
+				window[WINDOW_SIZE_Y] = field.window;
+				break;
+			}
+		}
+	}
+}
+
+void CLEncoder::encode(const double* values, cl_char* out)
+{
+	m_windows.resize(m_fields.size() * WINDOW_WORDS);
+	computeWindows(values, &m_windows[0]);
+
+	// Same rule as encodeFields
+	for (std::size_t f = 0; f < m_fields.size(); ++f)
+	{
+		const cl_int* window = &m_windows[f * WINDOW_WORDS];
+		int width = window[WINDOW_WIDTH];
+		int height = window[WINDOW_HEIGHT];
+		cl_char* bits = out + window[WINDOW_OFFSET];
+		for (int y = 0; y < height; ++y)
+		{
+			bool row = (y - window[WINDOW_START_Y] + height) % height < window[WINDOW_SIZE_Y];
+			for (int x = 0; x < width; ++x)
+				bits[y * width + x] = row && (x - window[WINDOW_START_X] + width) % width < window[WINDOW_SIZE_X];
+		}
+	}
+}
+
+cl::Event CLEncoder::enqueueEncode(const double* values, cl::Buffer& input, const std::vector<cl::Event>* waitFor)
+{
+	if (m_fields.empty())
+	{
+		throw std::runtime_error("Encoder has no fields!");
+	}
+
+	// Set up once the fields are known, and again only if fields were added since
+	if (m_encodeSize != m_size)
+	{
+		m_context.queue().finish();
+		m_windowData.clear();
+		for (int i = 0; i < STAGING_COUNT; ++i)
+		{
+			m_windowData.push_back(std::unique_ptr< CLBuffer<cl_int> >(new CLBuffer<cl_int>(m_context, m_fields.size() * WINDOW_WORDS)));
+			m_windowUploads[i] = cl::Event();
+		}
+		m_encodeKernel.setRange(m_context.device(), m_size);
+		m_encodeSize = m_size;
+	}
+
+	// The staging buffer was last uploaded two records ago, that upload has almost always completed
+	int staging = m_nextStaging;
+	m_nextStaging = (m_nextStaging + 1) % STAGING_COUNT;
+	CLBuffer<cl_int>& windows = *m_windowData[staging];
+	if (m_windowUploads[staging]())
+		m_windowUploads[staging].wait();
+	computeWindows(values, &windows[0]);
+	m_windowUploads[staging] = windows.enqueueWriteAsync();
+
+	m_encodeKernel.bind(windows.buffer(), cl_int(m_fields.size()), input);
+	return m_encodeKernel.launch(m_context, waitFor);
+}
@@ -0,0 +1,102 @@
+#ifndef CLENCODER_H_INCLUDED
+#define CLENCODER_H_INCLUDED
+
+#include <vector>
+#include <memory>
+#include "clcontext.h"
+#include "clbuffer.h"
+#include "clkernel.h"
+#include "clsensor.h"
+
+// Encodes records of several fields into one input pattern, each field into a range of bits of its own,
+// laid out in the order the fields were added. Every field sets a window of bits, so a record is described
+// by the position of one window per field. encode() writes the bits into a caller's buffer on the host,
+// enqueueEncode() uploads only the window positions and sets the bits on the device, straight into the
+// input buffer of a region. Construct it with the context of the region it feeds.
+class CLEncoder
+{
+private:
+	enum FieldType
+	{
+		FIELD_SCALAR,
+		FIELD_CATEGORY,
+		FIELD_PERIODIC,
+		FIELD_LOCATION
+	};
+	struct Field
+	{
+		FieldType type;
+		int offset; // first bit of the field
+		int width; // bits per row
+		int height; // rows, only locations have more than one
+		int window; // bits set per row, and rows set for locations
+		double period;
+		double minLatitude, maxLatitude, minLongitude, maxLongitude;
+		std::unique_ptr<CLSensor> sensor; // scalar fields
+	};
+
+	// Window of a field, one row of the window staging buffers. Must match FieldWindow in encoder.cl.
+	enum
+	{
+		WINDOW_OFFSET = 0,
+		WINDOW_WIDTH,
+		WINDOW_HEIGHT,
+		WINDOW_START_X,
+		WINDOW_START_Y,
+		WINDOW_SIZE_X,
+		WINDOW_SIZE_Y,
+		WINDOW_WORDS
+	};
+
+	CLContext& m_context;
+	std::vector<Field> m_fields;
+	int m_size;
+	int m_valueCount;
+
+	CLKernel m_encodeKernel;
+	int m_encodeSize; // bits the kernel range and the staging buffers are set up for
+	std::vector<cl_int> m_windows; // of encode()
+
+	// Windows are staged in two buffers in turn, so a record is filled in while the previous upload is in flight
+	static const int STAGING_COUNT = 2;
+	std::vector< std::unique_ptr< CLBuffer<cl_int> > > m_windowData;
+	cl::Event m_windowUploads[STAGING_COUNT];
+	int m_nextStaging;
+
+	Field& addField(FieldType type, int width, int height, int window);
+	// Fill the window rows of every field from a record
+	void computeWindows(const double* values, cl_int* windows);
+
+public:
+
+	explicit CLEncoder(CLContext& context);
+
+	// Scalars in windowSize bits out of totalSize, bucketed by the quantiles of the values seen, see CLSensor
+	int addScalar(int totalSize, int windowSize);
+	// Category indices from 0 to categoryCount - 1, each with windowSize bits of its own
+	int addCategory(int categoryCount, int windowSize);
+	// Values that repeat every period, like the time of day of a timestamp. The window wraps around.
+	int addPeriodic(int totalSize, int windowSize, double period);
+	// Time of day and day of week of timestamps in seconds
+	int addTimeOfDay(int totalSize, int windowSize) { return addPeriodic(totalSize, windowSize, 24 * 60 * 60); }
+	int addDayOfWeek(int totalSize, int windowSize) { return addPeriodic(totalSize, windowSize, 7 * 24 * 60 * 60); }
+	// Locations on a grid of gridWidth * gridHeight bits spanning the given bounds, as a square of windowSize * windowSize
+	// bits. Takes two values, latitude and longitude.
+	int addLocation(int gridWidth, int gridHeight, int windowSize, double minLatitude, double maxLatitude, double minLongitude, double maxLongitude);
+
+	// Bits of all fields
+	int size() const { return m_size; }
+	// Values per record, one per field and two per location
+	int valueCount() const { return m_valueCount; }
+	int fieldOffset(int field) const { return m_fields[field].offset; }
+	int fieldSize(int field) const { return m_fields[field].width * m_fields[field].height; }
+	// Quantile sensor of a scalar field, for decoding
+	CLSensor& sensor(int field);
+
+	// Encode a record of valueCount() values into size() bits at out
+	void encode(const double* values, cl_char* out);
+	// Encode a record into the first size() bytes of a device buffer
+	cl::Event enqueueEncode(const double* values, cl::Buffer& input, const std::vector<cl::Event>* waitFor = nullptr);
+};
+
+#endif
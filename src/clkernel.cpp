@@ -0,0 +1,118 @@
+#include "clkernel.h"
+
+CLKernel::CLKernel(const cl::Program& program, const char* name)
+	: m_kernel(program, name)
+	, m_name(name)
+	, m_metricsId(-1)
+	, m_global(cl::NullRange)
+	, m_local(cl::NullRange)
+{
+}
+
+void CLKernel::setRange(const cl::NDRange& global, const cl::NDRange& local)
+{
+	m_global = global;
+	m_local = local;
+}
+
+void CLKernel::setRange(const cl::Device& device, std::size_t length)
+{
+	std::size_t multiple = m_kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device);
+	std::size_t maxSize = workGroupSize(device);
+
+	std::size_t local = 0;
+	for (std::size_t size = multiple; multiple > 0 && size <= maxSize; size += multiple)
+	{
+		if (length % size == 0)
+			local = size;
+	}
+	setRange(cl::NDRange(length), local > 0 ? cl::NDRange(local) : cl::NullRange);
+}
+
+cl::Event CLKernel::launch(CLContext& context, const std::vector<cl::Event>* waitFor)
+{
+	context.barrier();
+	cl::Event event = enqueue(context.queue(), waitFor);
+	if (m_metricsId < 0)
+		m_metricsId = context.metrics().kernelId(m_name);
+	context.addLaunch(m_metricsId, event);
+	return event;
+}
+
+cl::Event CLKernel::enqueue(cl::CommandQueue& queue, const std::vector<cl::Event>* waitFor)
+{
+	cl::Event event;
+	queue.enqueueNDRangeKernel(m_kernel, cl::NullRange, m_global, m_local, waitFor && !waitFor->empty() ? waitFor : nullptr, &event);
+	return event;
+}
+
+std::size_t CLKernel::workGroupSize(const cl::Device& device) const
+{
+	return m_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+}
+
+int CLStepGraph::add(CLKernel& kernel)
+{
+	std::vector<int> dependencies;
+	if (!m_nodes.empty())
+		dependencies.push_back(m_nodes.size() - 1);
+	return add(kernel, dependencies);
+}
+
+int CLStepGraph::add(CLKernel& kernel, const std::vector<int>& dependencies)
+{
+	Node node = {&kernel, dependencies, true, cl::Event(), false, -1};
+	m_nodes.push_back(node);
+	m_done.resize(m_nodes.size());
+	return m_nodes.size() - 1;
+}
+
+void CLStepGraph::setEnabled(int node, bool enabled)
+{
+	m_nodes[node].enabled = enabled;
+}
+
+const std::vector<cl::Event>& CLStepGraph::run(CLContext& context, const std::vector<cl::Event>* waitFor)
+{
+	context.barrier();
+
+	for (std::size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		Node& node = m_nodes[i];
+		std::vector<cl::Event>& done = m_done[i];
+		done.clear();
+
+		// Gather what the dependencies stand for in this replay, skipped launches pass theirs on
+		if (node.dependencies.empty() && waitFor)
+			done = *waitFor;
+		for (int dependency : node.dependencies)
+			done.insert(done.end(), m_done[dependency].begin(), m_done[dependency].end());
+
+		node.launched = node.enabled;
+		if (node.enabled)
+		{
+			node.event = node.kernel->enqueue(context.queue(), &done);
+			done.assign(1, node.event);
+			if (m_observer)
+				m_observer(*node.kernel);
+		}
+	}
+	return m_done.back();
+}
+
+void CLStepGraph::record(CLMetrics& metrics)
+{
+	for (Node& node : m_nodes)
+	{
+		if (!node.launched)
+			continue;
+		if (node.metricsId < 0)
+			node.metricsId = metrics.kernelId(node.kernel->name());
+
+		cl_ulong time = 0;
+		if (metrics.profiling())
+			time = node.event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - node.event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		metrics.addKernelTime(node.metricsId, time);
+		node.launched = false;
+	}
+}
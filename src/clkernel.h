@@ -0,0 +1,108 @@
+#ifndef CLKERNEL_H_INCLUDED
+#define CLKERNEL_H_INCLUDED
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstddef>
+
+#include "clcontext.h"
+
+// A kernel with its launch range. Arguments stay bound between launches, so they are bound once and only
+// the ones that change, like the step counter, are set again before a launch.
+class CLKernel
+{
+private:
+	cl::Kernel m_kernel;
+	std::string m_name;
+	int m_metricsId; // of launch(), -1 until first launched
+	cl::NDRange m_global;
+	cl::NDRange m_local;
+
+	// Launch ordered by the events in waitFor only, for CLStepGraph
+	cl::Event enqueue(cl::CommandQueue& queue, const std::vector<cl::Event>* waitFor);
+	friend class CLStepGraph;
+
+	void setArgs(cl_uint) {}
+	template <class T, class... Rest>
+	void setArgs(cl_uint index, const T& value, const Rest&... rest)
+	{
+		m_kernel.setArg(index, value);
+		setArgs(index + 1, rest...);
+	}
+
+public:
+	CLKernel() : m_metricsId(-1) {}
+	CLKernel(const cl::Program& program, const char* name);
+
+	// Launch over global work-items in work-groups of local, NullRange lets the implementation choose
+	void setRange(const cl::NDRange& global, const cl::NDRange& local = cl::NullRange);
+	// Launch over length work-items in the largest work-groups that are a multiple of the device's
+	// preferred multiple and divide length, so the kernels need no bounds checks
+	void setRange(const cl::Device& device, std::size_t length);
+
+	// Bind arguments from the first on
+	template <class... Args>
+	void bind(const Args&... args)
+	{
+		setArgs(0, args...);
+	}
+	template <class T>
+	void setArg(cl_uint index, const T& value)
+	{
+		m_kernel.setArg(index, value);
+	}
+	void setLocalArg(cl_uint index, std::size_t bytes)
+	{
+		m_kernel.setArg(index, bytes, nullptr);
+	}
+
+	// Launch after everything queued on the context before and the events in waitFor. The launch is counted
+	// in the metrics of the context, see CLContext::recordLaunches().
+	cl::Event launch(CLContext& context, const std::vector<cl::Event>* waitFor = nullptr);
+
+	std::size_t workGroupSize(const cl::Device& device) const;
+	const std::string& name() const { return m_name; }
+};
+
+// The launches of one step, recorded once and replayed every step. Each launch waits for the events of the
+// launches it depends on only, so on out-of-order queues independent launches can overlap. Launches can be switched off for single steps,
+// their dependents then wait for what they depended on.
+class CLStepGraph
+{
+public:
+	// Called after each launch of a replay is queued, for tools that inspect the state between launches
+	typedef std::function<void(const CLKernel& kernel)> Observer;
+
+private:
+	struct Node
+	{
+		CLKernel* kernel;
+		std::vector<int> dependencies;
+		bool enabled;
+		cl::Event event; // of the last replay, if the launch ran
+		bool launched;
+		int metricsId; // in the CLMetrics of record(), -1 until first recorded
+	};
+	std::vector<Node> m_nodes;
+	std::vector< std::vector<cl::Event> > m_done; // events a dependent of each node waits for, per replay
+	Observer m_observer;
+
+public:
+	// Add a launch that depends on the launch added before it. Returns the index of the launch.
+	int add(CLKernel& kernel);
+	// Add a launch that depends on the given earlier launches only
+	int add(CLKernel& kernel, const std::vector<int>& dependencies);
+
+	void setEnabled(int node, bool enabled);
+	void setObserver(const Observer& observer) { m_observer = observer; }
+
+	// Launch the graph after everything queued on the context before, launches without dependencies also wait
+	// for waitFor. Returns the events of the last launch.
+	const std::vector<cl::Event>& run(CLContext& context, const std::vector<cl::Event>* waitFor = nullptr);
+	// Count the launches of the last replay, with their device time if the metrics profile. Call once the
+	// replay has completed, like after the blocking read of its results.
+	void record(CLMetrics& metrics);
+};
+
+#endif
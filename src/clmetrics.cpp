@@ -0,0 +1,96 @@
+#include "clmetrics.h"
+#include <sstream>
+#include <stdexcept>
+
+void CLPrometheusSink::sample(const std::string& name, Type type, const std::string& help, const std::string& labels, double value)
+{
+	Family& family = m_families[name];
+	family.type = type;
+	family.help = help;
+	family.samples.push_back(std::make_pair(labels, value));
+}
+
+std::string CLPrometheusSink::text() const
+{
+	std::ostringstream out;
+	out.precision(17);
+	for (auto& family : m_families)
+	{
+		out << "# HELP " << family.first << " " << family.second.help << "\n";
+		out << "# TYPE " << family.first << " " << (family.second.type == COUNTER ? "counter" : "gauge") << "\n";
+		for (auto& sample : family.second.samples)
+		{
+			out << family.first;
+			if (!sample.first.empty())
+				out << "{" << sample.first << "}";
+			out << " " << sample.second << "\n";
+		}
+	}
+	return out.str();
+}
+
+CLMetrics::CLMetrics(bool profiling)
+	: m_profiling(profiling)
+	, m_kernelCount(0)
+{
+	for (auto& counter : m_counters)
+		counter.store(0);
+	for (auto& gauge : m_gauges)
+		gauge.store(0);
+	for (auto& kernel : m_kernels)
+	{
+		kernel.launches.store(0);
+		kernel.nanoseconds.store(0);
+	}
+}
+
+int CLMetrics::kernelId(const std::string& name)
+{
+	int count = m_kernelCount.load(std::memory_order_relaxed);
+	for (int i = 0; i < count; i++)
+		if (m_kernels[i].name == name)
+			return i;
+
+	if (count == MAX_KERNELS)
+		throw std::runtime_error("Too many kernels for CLMetrics!");
+
+	m_kernels[count].name = name;
+	m_kernelCount.store(count + 1, std::memory_order_release);
+	return count;
+}
+
+std::string CLMetrics::label(const std::string& key, const std::string& value)
+{
+	std::string result = key + "=\"";
+	for (char c : value)
+	{
+		if (c == '\\' || c == '"')
+			result += '\\';
+		if (c == '\n')
+			result += "\\n";
+		else
+			result += c;
+	}
+	return result + "\"";
+}
+
+void CLMetrics::exportTo(CLMetricsSink& sink, const std::string& labels) const
+{
+	sink.sample("corticl_steps_total", CLMetricsSink::COUNTER, "Steps written to the region.", labels, (double)get(STEPS));
+	sink.sample("corticl_uploaded_bytes_total", CLMetricsSink::COUNTER, "Bytes copied from the host to the device.", labels, (double)get(BYTES_UPLOADED));
+	sink.sample("corticl_downloaded_bytes_total", CLMetricsSink::COUNTER, "Bytes copied from the device to the host.", labels, (double)get(BYTES_DOWNLOADED));
+	sink.sample("corticl_synapses_reset_total", CLMetricsSink::COUNTER, "Synapses pointed at a new target while learning.", labels, (double)get(SYNAPSES_RESET));
+	sink.sample("corticl_segments_adapted_total", CLMetricsSink::COUNTER, "Distal segments adapted while learning.", labels, (double)get(SEGMENTS_ADAPTED));
+	sink.sample("corticl_segment_pool_size", CLMetricsSink::GAUGE, "Distal segments the pool holds.", labels, (double)get(SEGMENT_POOL_SIZE));
+
+	int count = m_kernelCount.load(std::memory_order_acquire);
+	for (int i = 0; i < count; i++)
+	{
+		std::string kernelLabels = labels + (labels.empty() ? "" : ",") + label("kernel", m_kernels[i].name);
+		sink.sample("corticl_kernel_launches_total", CLMetricsSink::COUNTER, "Kernel launches.", kernelLabels,
+			(double)m_kernels[i].launches.load(std::memory_order_relaxed));
+		if (m_profiling)
+			sink.sample("corticl_kernel_seconds_total", CLMetricsSink::COUNTER, "Device time spent in kernels.", kernelLabels,
+				m_kernels[i].nanoseconds.load(std::memory_order_relaxed) * 1e-9);
+	}
+}
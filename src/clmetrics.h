@@ -0,0 +1,115 @@
+#ifndef CLMETRICS_H_INCLUDED
+#define CLMETRICS_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <cstdint>
+
+// Receives metric samples, see CLMetrics::exportTo()
+class CLMetricsSink
+{
+public:
+	enum Type
+	{
+		COUNTER,
+		GAUGE
+	};
+
+	virtual ~CLMetricsSink() {}
+
+	// One sample of the metric family name. labels are in Prometheus form without braces, like region="a",kernel="b".
+	virtual void sample(const std::string& name, Type type, const std::string& help, const std::string& labels, double value) = 0;
+};
+
+// Collects the samples of any number of regions and renders them in the Prometheus text format
+class CLPrometheusSink : public CLMetricsSink
+{
+private:
+	struct Family
+	{
+		Type type;
+		std::string help;
+		std::vector< std::pair<std::string, double> > samples;
+	};
+	std::map<std::string, Family> m_families;
+
+public:
+	void sample(const std::string& name, Type type, const std::string& help, const std::string& labels, double value) override;
+
+	std::string text() const;
+	void clear() { m_families.clear(); }
+};
+
+// Counters of the work submitted through one context, that is one region with its classifiers and encoders.
+// The thread stepping the region updates them, any other thread can read or export them at any time. Nothing
+// waits for the device: values that come from the device are folded in when a step reads back its results.
+class CLMetrics
+{
+public:
+	enum Counter
+	{
+		STEPS = 0,
+		BYTES_UPLOADED,
+		BYTES_DOWNLOADED,
+		SYNAPSES_RESET, // proximal and distal synapses pointed at a new target
+		SEGMENTS_ADAPTED, // distal segments whose queued changes were applied or reverted
+		COUNTER_COUNT
+	};
+	enum Gauge
+	{
+		SEGMENT_POOL_SIZE = 0,
+		GAUGE_COUNT
+	};
+
+private:
+	static const int MAX_KERNELS = 64;
+	struct KernelTime
+	{
+		std::string name;
+		std::atomic<std::uint64_t> launches;
+		std::atomic<std::uint64_t> nanoseconds;
+	};
+
+	bool m_profiling;
+	std::atomic<std::uint64_t> m_counters[COUNTER_COUNT];
+	std::atomic<std::int64_t> m_gauges[GAUGE_COUNT];
+	KernelTime m_kernels[MAX_KERNELS];
+	std::atomic<int> m_kernelCount; // published after the name of a kernel is set
+
+public:
+	// With profiling, the queue of the context records kernel start and end times
+	explicit CLMetrics(bool profiling);
+
+	CLMetrics(const CLMetrics&) = delete;
+	CLMetrics& operator=(const CLMetrics&) = delete;
+
+	bool profiling() const { return m_profiling; }
+
+	void add(Counter counter, std::uint64_t value)
+	{
+		m_counters[counter].fetch_add(value, std::memory_order_relaxed);
+	}
+	void set(Gauge gauge, std::int64_t value)
+	{
+		m_gauges[gauge].store(value, std::memory_order_relaxed);
+	}
+	std::uint64_t get(Counter counter) const { return m_counters[counter].load(std::memory_order_relaxed); }
+	std::int64_t get(Gauge gauge) const { return m_gauges[gauge].load(std::memory_order_relaxed); }
+
+	// Id of a kernel for addKernelTime(), registered on first use. Only called by the stepping thread.
+	int kernelId(const std::string& name);
+	void addKernelTime(int kernel, std::uint64_t nanoseconds)
+	{
+		m_kernels[kernel].launches.fetch_add(1, std::memory_order_relaxed);
+		m_kernels[kernel].nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+	}
+
+	// Label of a sample with the value escaped, like region="a"
+	static std::string label(const std::string& key, const std::string& value);
+	// Send every counter with the given labels, which identify the region
+	void exportTo(CLMetricsSink& sink, const std::string& labels) const;
+};
+
+#endif
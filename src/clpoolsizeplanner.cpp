@@ -0,0 +1,76 @@
+#include "clpoolsizeplanner.h"
+
+#include <algorithm>
+
+void CLPoolSizePlanner::add(const std::string& name, const std::function<std::size_t(int poolSize)>& bytes)
+{
+	Buffer buffer = {name, bytes};
+	m_buffers.push_back(buffer);
+}
+
+void CLPoolSizePlanner::add(const std::string& name, std::size_t bytes)
+{
+	add(name, [bytes](int) { return bytes; });
+}
+
+std::size_t CLPoolSizePlanner::totalBytes(int poolSize) const
+{
+	std::size_t total = 0;
+	for (const Buffer& buffer : m_buffers)
+		total += buffer.bytes(poolSize);
+	return total;
+}
+
+std::size_t CLPoolSizePlanner::largestBuffer(int poolSize) const
+{
+	std::size_t largest = 0;
+	for (const Buffer& buffer : m_buffers)
+		largest = std::max(largest, buffer.bytes(poolSize));
+	return largest;
+}
+
+std::size_t CLPoolSizePlanner::peakBytes(int initialPoolSize, int poolSize) const
+{
+	// Grow the way CLTemporalPooler does, the pool never starts above its limit
+	int size = std::min(initialPoolSize, poolSize);
+	std::size_t fixed = totalBytes(0);
+	std::size_t peak = totalBytes(size);
+	while (size < poolSize)
+	{
+		int grown = std::min(std::max(size * 2, 1), poolSize);
+		peak = std::max(peak, totalBytes(grown) + totalBytes(size) - fixed);
+		size = grown;
+	}
+	return peak;
+}
+
+bool CLPoolSizePlanner::fits(int initialPoolSize, int poolSize, std::size_t maxAllocation, std::size_t budget) const
+{
+	return largestBuffer(poolSize) <= maxAllocation && peakBytes(initialPoolSize, poolSize) <= budget;
+}
+
+int CLPoolSizePlanner::fittingPoolSize(int initialPoolSize, int maxPoolSize, std::size_t maxAllocation, std::size_t budget) const
+{
+	if (fits(initialPoolSize, maxPoolSize, maxAllocation, budget))
+		return maxPoolSize;
+
+	// Sizes only grow with the pool, search for the last pool size that fits
+	int low = 0, high = maxPoolSize;
+	while (high - low > 1)
+	{
+		int middle = low + (high - low) / 2;
+		if (fits(initialPoolSize, middle, maxAllocation, budget))
+			low = middle;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+void CLPoolSizePlanner::print(std::ostream& out, int initialPoolSize, int poolSize) const
+{
+	for (const Buffer& buffer : m_buffers)
+		out << "  " << buffer.name << ": " << buffer.bytes(poolSize) << " bytes" << std::endl;
+	out << "  Total: " << totalBytes(poolSize) << " bytes for a pool of " << poolSize << " segments, "
+		<< peakBytes(initialPoolSize, poolSize) << " bytes while growing" << std::endl;
+}
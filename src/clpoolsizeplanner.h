@@ -0,0 +1,44 @@
+#ifndef CLPOOLSIZEPLANNER_H_INCLUDED
+#define CLPOOLSIZEPLANNER_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <ostream>
+#include <cstddef>
+
+// Picks the size the segment pool of a region may grow to, from the device buffers the region will allocate as
+// computed from CLTopology and CLArgs. Buffers are not split, so a region whose fixed buffers exceed the device's
+// allocation limit does not fit at any pool size. Sizes of the buffers that scale with the pool are given per pool size.
+class CLPoolSizePlanner
+{
+public:
+	struct Buffer
+	{
+		std::string name;
+		std::function<std::size_t(int poolSize)> bytes;
+	};
+
+	void add(const std::string& name, const std::function<std::size_t(int poolSize)>& bytes);
+	void add(const std::string& name, std::size_t bytes);
+
+	const std::vector<Buffer>& buffers() const { return m_buffers; }
+	std::size_t totalBytes(int poolSize) const;
+	std::size_t largestBuffer(int poolSize) const;
+
+	// Most memory in use while the pool grows from initialPoolSize to poolSize. The pool doubles on each growth,
+	// and CLBuffer::resize() holds the old and the new buffer until the copy between them is done.
+	std::size_t peakBytes(int initialPoolSize, int poolSize) const;
+
+	// Whether every buffer fits into one allocation of maxAllocation bytes and the peak of growing to poolSize into budget bytes
+	bool fits(int initialPoolSize, int poolSize, std::size_t maxAllocation, std::size_t budget) const;
+	// Largest pool size up to maxPoolSize that fits, 0 if none does
+	int fittingPoolSize(int initialPoolSize, int maxPoolSize, std::size_t maxAllocation, std::size_t budget) const;
+
+	void print(std::ostream& out, int initialPoolSize, int poolSize) const;
+
+private:
+	std::vector<Buffer> m_buffers;
+};
+
+#endif
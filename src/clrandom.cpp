@@ -0,0 +1,55 @@
+#include "clrandom.h"
+
+CLRandom::CLRandom(std::uint64_t seed, cl_uint step, cl_uint item, cl_uint stream)
+	: m_key(makeKey(seed))
+	, m_remaining(0)
+{
+	m_counter.s[0] = step;
+	m_counter.s[1] = item;
+	m_counter.s[2] = stream;
+	m_counter.s[3] = 0;
+}
+
+cl_uint CLRandom::next()
+{
+	if (m_remaining == 0)
+	{
+		m_block = philox(m_counter, m_key);
+		m_counter.s[3]++;
+		m_remaining = 4;
+	}
+	return m_block.s[4 - m_remaining--];
+}
+
+float CLRandom::nextFloat()
+{
+	return (next() >> 8) * (1.0f / 16777216.0f);
+}
+
+cl_uint2 CLRandom::makeKey(std::uint64_t seed)
+{
+	cl_uint2 key;
+	key.s[0] = cl_uint(seed);
+	key.s[1] = cl_uint(seed >> 32);
+	return key;
+}
+
+cl_uint4 CLRandom::philox(cl_uint4 counter, cl_uint2 key)
+{
+	for (int i = 0; i < 10; ++i)
+	{
+		std::uint64_t p0 = std::uint64_t(0xD2511F53u) * counter.s[0];
+		std::uint64_t p1 = std::uint64_t(0xCD9E8D57u) * counter.s[2];
+
+		cl_uint4 next;
+		next.s[0] = cl_uint(p1 >> 32) ^ counter.s[1] ^ key.s[0];
+		next.s[1] = cl_uint(p1);
+		next.s[2] = cl_uint(p0 >> 32) ^ counter.s[3] ^ key.s[1];
+		next.s[3] = cl_uint(p0);
+		counter = next;
+
+		key.s[0] += 0x9E3779B9u;
+		key.s[1] += 0xBB67AE85u;
+	}
+	return counter;
+}
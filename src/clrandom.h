@@ -0,0 +1,32 @@
+#ifndef CLRANDOM_H_INCLUDED
+#define CLRANDOM_H_INCLUDED
+
+#include <cstdint>
+#include "clcontext.h"
+#include "cl/randomstreams.h"
+
+// Host side twin of the counter-based generator in cl/random.cl. A CLRandom created with the same
+// seed, step, item and stream produces exactly the numbers a kernel would draw.
+class CLRandom
+{
+private:
+	cl_uint2 m_key;
+	cl_uint4 m_counter;
+	cl_uint4 m_block;
+	int m_remaining;
+
+public:
+
+	CLRandom(std::uint64_t seed, cl_uint step = 0, cl_uint item = 0, cl_uint stream = 0);
+
+	cl_uint next();
+	// Uniform float in [0, 1)
+	float nextFloat();
+
+	// Split a 64-bit seed to the key passed to kernels
+	static cl_uint2 makeKey(std::uint64_t seed);
+
+	static cl_uint4 philox(cl_uint4 counter, cl_uint2 key);
+};
+
+#endif
@@ -3,33 +3,159 @@
 #include <stdexcept>
 #include <cassert>
 #include <random>
+#include <algorithm>
 
 #include "clregion.h"
 
 CLRegion::CLRegion(CLContext& context, const CLTopology& topo, const CLArgs& args)
-  : m_context(context)
-  , m_spatialPooler(context, topo, args)
-  , m_temporalPooler(context, topo, args)
+  : m_context(context.fork(args.KernelProfiling))
+  , m_args(limitSegmentPool(*m_context, topo, args, m_poolSizePlanner, m_reservation))
+  , m_spatialPooler(*m_context, topo, m_args)
+  , m_temporalPooler(*m_context, topo, m_args)
+  , m_activeColumns(topo.getColumns())
 {
-	std::cerr << "Device memory allocation limit: " << m_context.device().getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() << std::endl;
 };
-void CLRegion::write(std::vector< cl_char >& activations, std::vector< cl_char >& results, bool temporal)
+CLArgs CLRegion::limitSegmentPool(CLContext& context, const CLTopology& topo, const CLArgs& args, CLPoolSizePlanner& planner, Reservation& reservation)
+{
+	CLSpatialPooler::addBuffers(topo, args, planner);
+	CLTemporalPooler::addBuffers(topo, args, planner);
+
+	std::size_t maxAllocation = context.device().getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+	std::size_t budget = context.device().getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>() * args.DeviceMemoryBudget;
+
+	int initialPoolSize = CLTemporalPooler::initialPoolSize(topo, args);
+	int maxPoolSize = CLTemporalPooler::maxPoolSize(topo, args);
+	int minPoolSize = std::min(maxPoolSize, topo.getColumns());
+
+	// A smaller pool does not help a buffer that is too large already
+	for (const CLPoolSizePlanner::Buffer& buffer : planner.buffers())
+	{
+		if (buffer.bytes(minPoolSize) > maxAllocation)
+		{
+			planner.print(std::cerr, initialPoolSize, minPoolSize);
+			throw std::runtime_error("Buffer exceeds the device's allocation limit: " + buffer.name + "!");
+		}
+	}
+
+	int poolSize = 0;
+	std::size_t available = 0;
+
+	// Regions on the same device share its budget, each reserves the peak of growing its pool to its limit
+	reservation.bytes = context.reserveDeviceMemory(budget, [&](std::size_t left) -> std::size_t
+	{
+		available = left;
+		poolSize = planner.fittingPoolSize(initialPoolSize, maxPoolSize, maxAllocation, left);
+		if (poolSize < minPoolSize)
+			return 0;
+		return planner.peakBytes(initialPoolSize, poolSize);
+	});
+	reservation.context = &context;
+	std::cerr << "Device memory allocation limit: " << maxAllocation << ", budget: " << budget << ", left: " << available << std::endl;
+
+	if (poolSize < minPoolSize)
+	{
+		// Fewer segments than columns, the region would not be able to learn much
+		planner.print(std::cerr, initialPoolSize, maxPoolSize);
+		throw std::runtime_error("Region does not fit into device memory!");
+	}
+
+	CLArgs ret = args;
+	if (poolSize < maxPoolSize)
+	{
+		std::cerr << "Segment pool limited to " << poolSize << " of " << maxPoolSize << " segments by device memory" << std::endl;
+		ret.SegmentPoolLimit = poolSize;
+	}
+	planner.print(std::cerr, initialPoolSize, poolSize);
+	return ret;
+}
+void CLRegion::write(const std::vector< cl_char >& activations, std::vector< cl_char >& results, bool temporal, float* anomalyScore)
 {
 	// 1. Feed given input bit pattern first to the spatial pooler
 	// 2. Obtain column activations
 	// 3. Feed columns to temporal pooler
 
-	std::vector<cl_char> activeColumns = m_spatialPooler.write(activations);
-	if (!temporal)
+	if (activations.size() != std::size_t(m_spatialPooler.inputSize()))
 	{
-		results = activeColumns;
-		return;
+		throw std::runtime_error("Invalid vector length!");
 	}
-	m_temporalPooler.write(activeColumns, results);
+	results.resize(m_activeColumns.size());
+	write(activations.data(), results.data(), temporal, anomalyScore);
+}
+void CLRegion::write(const cl_char* activations, cl_char* results, bool temporal, float* anomalyScore)
+{
+	// Without temporal pooling the spatial pooler writes straight into results
+	m_context->metrics().add(CLMetrics::STEPS, 1);
+	m_spatialPooler.write(activations, temporal ? m_activeColumns.data() : results);
+	writeColumns(results, temporal, anomalyScore);
+}
+void CLRegion::write(CLEncoder& encoder, const double* values, std::vector<cl_char>& results, bool temporal, float* anomalyScore)
+{
+	results.resize(m_activeColumns.size());
+	write(encoder, values, results.data(), temporal, anomalyScore);
+}
+void CLRegion::write(CLEncoder& encoder, const double* values, cl_char* results, bool temporal, float* anomalyScore)
+{
+	m_context->metrics().add(CLMetrics::STEPS, 1);
+	m_spatialPooler.write(encoder, values, temporal ? m_activeColumns.data() : results);
+	writeColumns(results, temporal, anomalyScore);
+}
+void CLRegion::writeColumns(cl_char* results, bool temporal, float* anomalyScore)
+{
+	if (temporal)
+		m_temporalPooler.write(m_activeColumns.data(), results, anomalyScore);
+	else if (anomalyScore)
+		*anomalyScore = 0;
+
+	// The results were read back, so every launch of the step has completed
+	m_context->recordLaunches();
 }
 void CLRegion::backwards(const std::vector< cl_char >& columnActivation, std::vector< double >& result)
 {
 	m_spatialPooler.backwards(columnActivation, result);
+	m_context->recordLaunches();
+}
+
+// First snapshot source id of each pooler
+static const int SPATIAL_SNAPSHOT_ID = 0;
+static const int TEMPORAL_SNAPSHOT_ID = 16;
+
+void CLRegion::snapshotSources(std::vector<CLSnapshotSource>& sources)
+{
+	m_spatialPooler.snapshotSources(sources, SPATIAL_SNAPSHOT_ID);
+	m_temporalPooler.snapshotSources(sources, TEMPORAL_SNAPSHOT_ID);
+}
+void CLRegion::restore(const CLSnapshotImage& image)
+{
+	m_spatialPooler.restore(image, SPATIAL_SNAPSHOT_ID);
+	m_temporalPooler.restore(image, TEMPORAL_SNAPSHOT_ID);
+	m_context->queue().finish();
+}
+
+void CLRegion::exportMetrics(CLMetricsSink& sink, const std::string& name) const
+{
+	std::string labels = CLMetrics::label("region", name);
+	const CLMetrics& metrics = m_context->metrics();
+	metrics.exportTo(sink, labels);
+
+	// Buffers that scale with the pool are sized for the pool as it is now
+	int poolSize = metrics.get(CLMetrics::SEGMENT_POOL_SIZE);
+	for (auto& buffer : m_poolSizePlanner.buffers())
+	{
+		sink.sample("corticl_device_buffer_bytes", CLMetricsSink::GAUGE, "Device memory allocated per buffer.",
+			labels + "," + CLMetrics::label("buffer", buffer.name), (double)buffer.bytes(poolSize));
+	}
+}
+
+void CLRegion::setStepObserver(const std::function<void(const std::string& phase)>& observer)
+{
+	if (!observer)
+	{
+		m_spatialPooler.setStepObserver(CLStepGraph::Observer());
+		m_temporalPooler.setStepObserver(CLStepGraph::Observer());
+		return;
+	}
+	m_spatialPooler.setStepObserver([observer](const CLKernel& kernel) { observer("spatial." + kernel.name()); });
+	m_temporalPooler.setStepObserver([observer](const CLKernel& kernel) { observer("temporal." + kernel.name()); });
 }
 
 CLStats CLRegion::getStats()
@@ -5,12 +5,15 @@
 #include <string>
 #include <memory>
 #include <map>
+#include <functional>
 
 #include "clcontext.h"
 #include "clspatial.h"
 #include "cltemporal.h"
 #include "cltopology.h"
 #include "clargs.h"
+#include "clpoolsizeplanner.h"
+#include "clmetrics.h"
 
 std::string getCLError(cl_int err);
 
@@ -19,35 +22,105 @@ struct CLStats
 	// Spatial pooler
 	double averageBoost;
 	double averageDutyCycle;
+	int inhibitionRadius; // current neighbourhood width, -1 for global inhibition
 
 	// Temporal pooler
 	int predictiveState; // number of cells in predictive state
 	int activeState; // number of cells in active state
 	int learningState; // number of cells in learning state
 	double averageSegmentDutyCycle;
+	int maxSegments; // capacity of the segment pool when fully grown
+	int maxSynapses;
+	int totalSegments; // segments in use
+	int totalSynapses;
 };
 
+// Regions are independent of each other: every region submits to a command queue of its own and creates
+// its own kernel objects, and no mutable host state is shared. Compiled programs are shared between regions
+// of the same configuration through the context's program cache, which is locked. Different regions can
+// therefore be stepped in parallel from different host threads, for example from a thread pool. A single
+// region must only be used from one thread at a time.
 class CLRegion
 {
 private:
-	CLContext& m_context;
+	// Device memory reserved for the region out of the budget its context shares with its forks, given back on destruction
+	struct Reservation
+	{
+		CLContext* context;
+		std::size_t bytes;
+
+		Reservation() : context(nullptr), bytes(0) {}
+		~Reservation() { if (context) context->releaseDeviceMemory(bytes); }
+		Reservation(const Reservation&) = delete;
+		Reservation& operator=(const Reservation&) = delete;
+	};
+
+	std::unique_ptr<CLContext> m_context; // shares the device of the context given to the constructor
+	CLPoolSizePlanner m_poolSizePlanner;
+	Reservation m_reservation;
+	CLArgs m_args; // with the segment pool limited to what fits the device
+
+	// Limit the segment pool to what is left of the device's budget and reserve it. Every buffer must fit into a
+	// single allocation and the whole region into device memory: buffers are not split into chunks and columns
+	// are not paged in from the host.
+	static CLArgs limitSegmentPool(CLContext& context, const CLTopology& topo, const CLArgs& args, CLPoolSizePlanner& planner, Reservation& reservation);
 
 	CLSpatialPooler m_spatialPooler;
 	CLTemporalPooler m_temporalPooler;
 
+	std::vector<cl_char> m_activeColumns; // spatial pooler output on its way to the temporal pooler
+
+	// Feed the columns activated by the spatial pooler to the temporal pooler
+	void writeColumns(cl_char* results, bool temporal, float* anomalyScore);
+
 public:
 
 	CLRegion(CLContext& context, const CLTopology& topo, const CLArgs& args);
 
+	// Not movable, the step graphs of the poolers point at their kernels
 	CLRegion(const CLRegion&) = delete;
-	CLRegion(CLRegion&&) = default;
+	CLRegion& operator=(const CLRegion&) = delete;
 
 	// Primary input function
-	void write(std::vector<cl_char> & activations, std::vector<cl_char>& results, bool temporal = true);
+	// anomalyScore, if given, receives the fraction of active columns the temporal pooler did not predict (0 without temporal pooling)
+	void write(const std::vector<cl_char>& activations, std::vector<cl_char>& results, bool temporal = true, float* anomalyScore = nullptr);
+	// activations holds the input bits of the topology and results receives one activation per column. Once the
+	// segment pool stopped growing, steps through this overload do not allocate on the host.
+	void write(const cl_char* activations, cl_char* results, bool temporal = true, float* anomalyScore = nullptr);
+
+	// Input from a record of encoder.valueCount() values, encoded on the device. The encoder must be constructed with
+	// context() and produce as many bits as the input of the topology.
+	void write(CLEncoder& encoder, const double* values, std::vector<cl_char>& results, bool temporal = true, float* anomalyScore = nullptr);
+	void write(CLEncoder& encoder, const double* values, cl_char* results, bool temporal = true, float* anomalyScore = nullptr);
 
 	// Noisy backwards convolution: Find out what kind of bit pattern would cause the given column activation
+	// Several activations can be passed back to back, the reconstructions are returned in the same order
 	void backwards(const std::vector<cl_char>& columnActivation, std::vector<double>& result);
 
+	// Number of input bits a step takes
+	int inputSize() const { return m_spatialPooler.inputSize(); }
+
+	// Context with the queue of this region. Objects that share buffers with the region, like a CLClassifier, should use it.
+	CLContext& context() { return *m_context; }
+
+	// Temporal pooler of the region, for classifiers that read its cell states on the device
+	CLTemporalPooler& temporalPooler() { return m_temporalPooler; }
+
+	// Buffers and host state captured by a CLSnapshotter
+	void snapshotSources(std::vector<CLSnapshotSource>& sources);
+	// Continue from a snapshot taken of a region with the same topology and arguments
+	void restore(const CLSnapshotImage& image);
+
+	// Called after each kernel launch of a step is queued, with the phase named like "spatial.computeOverlap".
+	// For debugging tools like CLReplay, an empty function removes the observer.
+	void setStepObserver(const std::function<void(const std::string& phase)>& observer);
+
+	// Steps, transfers, kernel times and learning counters of this region, see CLMetrics
+	const CLMetrics& metrics() const { return m_context->metrics(); }
+	// Send the metrics of this region and the device memory of its buffers to sink, labelled region="name".
+	// Reads host counters only, so it can be called from any thread while the region steps.
+	void exportMetrics(CLMetricsSink& sink, const std::string& name) const;
+
 	// Read statistics from network. This can be very expensive as the full network has to be downloaded from the computing device.
 	CLStats getStats();
 };
@@ -0,0 +1,274 @@
+#include "clreplay.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+namespace
+{
+	const char* TRACE_HEADER = "corticl-trace";
+	const std::uint32_t INPUTS_MAGIC = 0x49524c43; // "CLRI"
+
+	std::uint64_t hashBytes(const char* data, std::size_t length)
+	{
+		// FNV-1a
+		std::uint64_t hash = 14695981039346656037ull;
+		for (std::size_t i = 0; i < length; ++i)
+		{
+			hash ^= std::uint8_t(data[i]);
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	CLDivergence divergence(std::uint32_t step, const std::string& phase, const std::string& buffer, std::size_t index)
+	{
+		CLDivergence ret = {true, step, phase, buffer, index};
+		return ret;
+	}
+}
+
+std::string CLDivergence::describe() const
+{
+	if (!diverged)
+		return "No divergence";
+
+	std::ostringstream out;
+	out << "Step " << step << ", phase " << phase << ": ";
+	if (buffer.empty())
+		out << "the runs went through different phases";
+	else
+		out << buffer << " differs from element " << index;
+	return out.str();
+}
+
+void CLReplayTrace::save(const std::string& path) const
+{
+	std::ofstream out(path.c_str());
+	out << TRACE_HEADER << " " << blockSize << "\n" << std::hex;
+	for (const Entry& entry : entries)
+	{
+		out << std::dec << entry.step << " " << entry.phase << " " << entry.buffer << " " << entry.elementSize << " " << entry.blockHashes.size() << std::hex;
+		for (std::uint64_t hash : entry.blockHashes)
+			out << " " << hash;
+		out << "\n";
+	}
+	if (!out)
+		throw std::runtime_error("Cannot write replay trace!");
+}
+
+bool CLReplayTrace::load(const std::string& path, CLReplayTrace& trace)
+{
+	std::ifstream in(path.c_str());
+	std::string header;
+	if (!(in >> header >> trace.blockSize) || header != TRACE_HEADER)
+		return false;
+
+	trace.entries.clear();
+	Entry entry;
+	std::size_t blockCount;
+	while (in >> std::dec >> entry.step >> entry.phase >> entry.buffer >> entry.elementSize >> blockCount)
+	{
+		entry.blockHashes.resize(blockCount);
+		for (std::uint64_t& hash : entry.blockHashes)
+			in >> std::hex >> hash;
+		if (!in)
+			return false;
+		trace.entries.push_back(entry);
+	}
+	return in.eof();
+}
+
+CLDivergence CLReplayTrace::compare(const CLReplayTrace& a, const CLReplayTrace& b)
+{
+	if (a.blockSize != b.blockSize)
+		throw std::runtime_error("Traces were taken with different block sizes!");
+
+	std::size_t count = std::min(a.entries.size(), b.entries.size());
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		const Entry& entryA = a.entries[i];
+		const Entry& entryB = b.entries[i];
+		if (entryA.step != entryB.step || entryA.phase != entryB.phase || entryA.buffer != entryB.buffer)
+			return divergence(entryA.step, entryA.phase, "", 0);
+
+		// A buffer of a different size differs from the end of the shorter one on
+		std::size_t blocks = std::min(entryA.blockHashes.size(), entryB.blockHashes.size());
+		std::size_t block = std::mismatch(entryA.blockHashes.begin(), entryA.blockHashes.begin() + blocks, entryB.blockHashes.begin()).first - entryA.blockHashes.begin();
+		if (block < blocks || entryA.blockHashes.size() != entryB.blockHashes.size())
+			return divergence(entryA.step, entryA.phase, entryA.buffer, block * a.blockSize / entryA.elementSize);
+	}
+
+	// One run went on for longer, the runs agree up to where the shorter one ends
+	CLDivergence ret = {false, 0, "", "", 0};
+	return ret;
+}
+
+CLReplay::CLReplay(CLContext& context, const CLTopology& topo, const CLArgs& args)
+	: m_region(context, topo, args)
+	, m_steps(0)
+{
+}
+
+void CLReplay::capture()
+{
+	cl::CommandQueue& queue = m_region.context().queue();
+	queue.finish();
+
+	m_sources.clear();
+	m_region.snapshotSources(m_sources);
+	m_data.resize(m_sources.size());
+	for (std::size_t i = 0; i < m_sources.size(); ++i)
+	{
+		const CLSnapshotSource& source = m_sources[i];
+		if (!source.hostData.empty())
+		{
+			m_data[i] = source.hostData;
+			continue;
+		}
+		m_data[i].resize(source.byteSize);
+		if (source.byteSize > 0)
+			queue.enqueueReadBuffer(source.buffer, CL_TRUE, 0, source.byteSize, m_data[i].data());
+	}
+}
+
+void CLReplay::step(const std::vector<cl_char>& input, bool temporal, const Visitor& visitor)
+{
+	m_region.setStepObserver([this, &visitor](const std::string& phase)
+	{
+		capture();
+		visitor(phase, m_sources, m_data);
+	});
+	m_region.write(input, m_output, temporal);
+	m_region.setStepObserver(std::function<void(const std::string&)>());
+
+	// Work outside the step graphs, like segment compaction, shows in the state after the step
+	capture();
+	visitor("step", m_sources, m_data);
+	m_steps++;
+}
+
+CLReplayTrace CLReplay::trace(CLContext& context, const CLTopology& topo, const CLArgs& args,
+	const std::vector< std::vector<cl_char> >& inputs, bool temporal, std::size_t blockSize)
+{
+	CLReplayTrace trace;
+	trace.blockSize = blockSize;
+
+	CLReplay replay(context, topo, args);
+	for (const std::vector<cl_char>& input : inputs)
+	{
+		replay.step(input, temporal, [&](const std::string& phase, const std::vector<CLSnapshotSource>& sources, const std::vector< std::vector<char> >& data)
+		{
+			for (std::size_t i = 0; i < sources.size(); ++i)
+			{
+				CLReplayTrace::Entry entry;
+				entry.step = replay.steps();
+				entry.phase = phase;
+				entry.buffer = sources[i].name;
+				entry.elementSize = sources[i].elementSize;
+				for (std::size_t offset = 0; offset < data[i].size(); offset += blockSize)
+					entry.blockHashes.push_back(hashBytes(&data[i][offset], std::min(blockSize, data[i].size() - offset)));
+				trace.entries.push_back(entry);
+			}
+		});
+	}
+	return trace;
+}
+
+CLDivergence CLReplay::lockstep(CLContext& a, CLContext& b, const CLTopology& topo, const CLArgs& args,
+	const std::vector< std::vector<cl_char> >& inputs, bool temporal)
+{
+	struct Phase
+	{
+		std::string name;
+		std::vector< std::vector<char> > data;
+	};
+	std::vector<Phase> phases; // of the current step on a, kept to reuse their storage
+	std::size_t phaseCount = 0;
+
+	CLReplay replayA(a, topo, args);
+	CLReplay replayB(b, topo, args);
+	CLDivergence result = {false, 0, "", "", 0};
+
+	for (const std::vector<cl_char>& input : inputs)
+	{
+		phaseCount = 0;
+		replayA.step(input, temporal, [&](const std::string& phase, const std::vector<CLSnapshotSource>&, const std::vector< std::vector<char> >& data)
+		{
+			if (phaseCount == phases.size())
+				phases.resize(phaseCount + 1);
+			phases[phaseCount].name = phase;
+			phases[phaseCount].data = data;
+			phaseCount++;
+		});
+
+		std::size_t phase = 0;
+		std::uint32_t step = replayB.steps();
+		replayB.step(input, temporal, [&](const std::string& name, const std::vector<CLSnapshotSource>& sources, const std::vector< std::vector<char> >& data)
+		{
+			// Only the first divergence is reported, later phases follow from it
+			if (result.diverged)
+				return;
+			if (phase >= phaseCount || phases[phase].name != name || phases[phase].data.size() != data.size())
+			{
+				result = divergence(step, name, "", 0);
+				return;
+			}
+
+			const std::vector< std::vector<char> >& expected = phases[phase++].data;
+			for (std::size_t i = 0; i < data.size(); ++i)
+			{
+				std::size_t length = std::min(expected[i].size(), data[i].size());
+				std::size_t byte = std::mismatch(data[i].begin(), data[i].begin() + length, expected[i].begin()).first - data[i].begin();
+				if (byte < length || expected[i].size() != data[i].size())
+				{
+					result = divergence(step, name, sources[i].name, byte / sources[i].elementSize);
+					return;
+				}
+			}
+		});
+		if (!result.diverged && phase != phaseCount)
+			result = divergence(step, phases[phase].name, "", 0);
+		if (result.diverged)
+			break;
+	}
+	return result;
+}
+
+void CLReplay::saveInputs(const std::string& path, const std::vector< std::vector<cl_char> >& inputs)
+{
+	// u32 magic, u64 input count, u64 input length, then the inputs
+	std::ofstream out(path.c_str(), std::ios::binary);
+	std::uint64_t count = inputs.size();
+	std::uint64_t length = inputs.empty() ? 0 : inputs.front().size();
+	out.write(reinterpret_cast<const char*>(&INPUTS_MAGIC), sizeof(INPUTS_MAGIC));
+	out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+	out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+	for (const std::vector<cl_char>& input : inputs)
+	{
+		if (input.size() != length)
+			throw std::runtime_error("Replay inputs differ in length!");
+		out.write(reinterpret_cast<const char*>(input.data()), length);
+	}
+	if (!out)
+		throw std::runtime_error("Cannot write replay inputs!");
+}
+
+bool CLReplay::loadInputs(const std::string& path, std::vector< std::vector<cl_char> >& inputs)
+{
+	std::ifstream in(path.c_str(), std::ios::binary);
+	std::uint32_t magic;
+	std::uint64_t count, length;
+	if (!in.read(reinterpret_cast<char*>(&magic), sizeof(magic)) || magic != INPUTS_MAGIC
+		|| !in.read(reinterpret_cast<char*>(&count), sizeof(count)) || !in.read(reinterpret_cast<char*>(&length), sizeof(length)))
+		return false;
+
+	inputs.assign(count, std::vector<cl_char>(length));
+	for (std::vector<cl_char>& input : inputs)
+	{
+		if (!in.read(reinterpret_cast<char*>(input.data()), length))
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,88 @@
+#ifndef CLREPLAY_H_INCLUDED
+#define CLREPLAY_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#include "clregion.h"
+#include "clsnapshot.h"
+
+// Where two runs of the same inputs first differ
+struct CLDivergence
+{
+	bool diverged;
+	std::uint32_t step;
+	std::string phase; // as named by CLRegion::setStepObserver, or "step" for the state after the whole step
+	std::string buffer; // snapshot source name, empty if the runs went through different phases
+	std::size_t index; // first element that differs, for traces the first element of the first block that differs
+
+	std::string describe() const;
+};
+
+// Hashes of a region's state after every phase of every step, taken by CLReplay::trace(). The state is hashed
+// in blocks of blockSize bytes so that compare() can narrow a divergence down to a block.
+struct CLReplayTrace
+{
+	struct Entry
+	{
+		std::uint32_t step;
+		std::string phase;
+		std::string buffer;
+		std::uint64_t elementSize;
+		std::vector<std::uint64_t> blockHashes;
+	};
+
+	std::uint64_t blockSize;
+	std::vector<Entry> entries;
+
+	// Traces are text, one entry per line
+	void save(const std::string& path) const;
+	static bool load(const std::string& path, CLReplayTrace& trace);
+
+	// First entry where two traces of the same inputs, topology and arguments disagree
+	static CLDivergence compare(const CLReplayTrace& a, const CLReplayTrace& b);
+};
+
+// Steps a region through recorded inputs and captures its whole state, the buffers and host state a snapshot
+// would take, after every kernel launch. Runs on different devices or with different kernel variants can then
+// be compared phase by phase: across hosts through traces, within one process exactly with lockstep().
+// Every phase waits for the device and downloads the region, so this is for debugging only.
+class CLReplay
+{
+public:
+	typedef std::function<void(const std::string& phase, const std::vector<CLSnapshotSource>& sources, const std::vector< std::vector<char> >& data)> Visitor;
+
+private:
+	CLRegion m_region;
+	std::vector<cl_char> m_output;
+	std::vector<CLSnapshotSource> m_sources;
+	std::vector< std::vector<char> > m_data; // contents of m_sources
+	std::uint32_t m_steps;
+
+	void capture();
+
+public:
+	CLReplay(CLContext& context, const CLTopology& topo, const CLArgs& args);
+
+	CLReplay(const CLReplay&) = delete;
+	CLReplay& operator=(const CLReplay&) = delete;
+
+	// Write one input and visit the state after every phase of the step, the last phase is "step"
+	void step(const std::vector<cl_char>& input, bool temporal, const Visitor& visitor);
+	std::uint32_t steps() const { return m_steps; }
+	CLRegion& region() { return m_region; }
+
+	static CLReplayTrace trace(CLContext& context, const CLTopology& topo, const CLArgs& args,
+		const std::vector< std::vector<cl_char> >& inputs, bool temporal = true, std::size_t blockSize = 256);
+	// Step a region on each context side by side and compare their states byte for byte after every phase
+	static CLDivergence lockstep(CLContext& a, CLContext& b, const CLTopology& topo, const CLArgs& args,
+		const std::vector< std::vector<cl_char> >& inputs, bool temporal = true);
+
+	// Recorded inputs, all of the same length
+	static void saveInputs(const std::string& path, const std::vector< std::vector<cl_char> >& inputs);
+	static bool loadInputs(const std::string& path, std::vector< std::vector<cl_char> >& inputs);
+};
+
+#endif
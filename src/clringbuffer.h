@@ -0,0 +1,136 @@
+#ifndef CLRINGBUFFER_H_INCLUDED
+#define CLRINGBUFFER_H_INCLUDED
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+// Bounded lock-free queue for any number of producers and consumers. Every slot carries a sequence
+// number telling whose turn it is, so producers and consumers only contend on the slot positions.
+// Items are copied into slots on push and swapped out on pop, so buffers such as std::vector keep their
+// capacity and cycle between producers and consumers without further allocations.
+template <class T>
+class CLRingBuffer
+{
+private:
+	struct Slot
+	{
+		std::atomic<std::size_t> sequence;
+		T data;
+	};
+
+	std::vector<Slot> m_slots;
+	std::size_t m_mask;
+
+	// Keep the positions on separate cache lines
+	char m_padding0[64];
+	std::atomic<std::size_t> m_pushPosition;
+	char m_padding1[64];
+	std::atomic<std::size_t> m_popPosition;
+	char m_padding2[64];
+
+public:
+
+	// Capacity is rounded up to a power of two
+	CLRingBuffer(std::size_t capacity)
+		: m_slots(roundUp(capacity))
+		, m_mask(m_slots.size() - 1)
+		, m_pushPosition(0)
+		, m_popPosition(0)
+	{
+		for (std::size_t i = 0; i < m_slots.size(); ++i)
+			m_slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	CLRingBuffer(const CLRingBuffer&) = delete;
+
+	// Returns false without waiting if the queue is full
+	bool tryPush(const T& item)
+	{
+		return tryPushWith([&](T& slot) { slot = item; });
+	}
+
+	// Like tryPush, but fill writes the item straight into the slot
+	template <class F>
+	bool tryPushWith(F fill)
+	{
+		Slot* slot;
+		std::size_t position = m_pushPosition.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			slot = &m_slots[position & m_mask];
+			std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			std::intptr_t difference = std::intptr_t(sequence) - std::intptr_t(position);
+			if (difference == 0)
+			{
+				if (m_pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = m_pushPosition.load(std::memory_order_relaxed);
+			}
+		}
+		fill(slot->data);
+		slot->sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Returns false without waiting if the queue is empty. The previous contents of item are left in the slot for reuse.
+	bool tryPop(T& item)
+	{
+		Slot* slot;
+		std::size_t position = m_popPosition.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			slot = &m_slots[position & m_mask];
+			std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			std::intptr_t difference = std::intptr_t(sequence) - std::intptr_t(position + 1);
+			if (difference == 0)
+			{
+				if (m_popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = m_popPosition.load(std::memory_order_relaxed);
+			}
+		}
+		std::swap(item, slot->data);
+		slot->sequence.store(position + m_mask + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Approximate number of queued items while other threads are pushing or popping
+	std::size_t size() const
+	{
+		std::size_t pushed = m_pushPosition.load(std::memory_order_relaxed);
+		std::size_t popped = m_popPosition.load(std::memory_order_relaxed);
+		return pushed > popped ? pushed - popped : 0;
+	}
+	std::size_t capacity() const
+	{
+		return m_slots.size();
+	}
+
+private:
+	static std::size_t roundUp(std::size_t capacity)
+	{
+		std::size_t ret = 1;
+		while (ret < capacity)
+			ret *= 2;
+		return ret;
+	}
+};
+
+#endif
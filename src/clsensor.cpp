@@ -0,0 +1,265 @@
+#include "clsensor.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <cmath>
+
+CLQuantileDigest::CLQuantileDigest(double compression)
+	: m_compression(compression)
+	, m_bufferSize(std::size_t(compression * 5))
+	, m_totalWeight(0)
+	, m_min(std::numeric_limits<double>::max())
+	, m_max(std::numeric_limits<double>::lowest())
+{
+	m_buffer.reserve(m_bufferSize);
+}
+
+double CLQuantileDigest::scale(double q) const
+{
+	const double pi = 3.14159265358979323846;
+	return m_compression / (2 * pi) * std::asin(2 * q - 1);
+}
+
+void CLQuantileDigest::add(double value)
+{
+	m_min = std::min(m_min, value);
+	m_max = std::max(m_max, value);
+
+	m_buffer.push_back(value);
+	if (m_buffer.size() >= m_bufferSize)
+		merge();
+}
+
+void CLQuantileDigest::merge()
+{
+	if (m_buffer.empty())
+		return;
+
+	std::sort(m_buffer.begin(), m_buffer.end());
+
+	double total = m_totalWeight + m_buffer.size();
+	double weightSoFar = 0;
+	Centroid current = {0, 0};
+
+	// Walk centroids and buffered samples in order, growing the current centroid while the scale function allows
+	auto append = [&](const Centroid& next)
+	{
+		if (current.weight == 0)
+		{
+			current = next;
+			return;
+		}
+		double q0 = weightSoFar / total;
+		double q2 = (weightSoFar + current.weight + next.weight) / total;
+		if (scale(q2) - scale(q0) <= 1)
+		{
+			current.weight += next.weight;
+			current.mean += (next.mean - current.mean) * next.weight / current.weight;
+		}
+		else
+		{
+			m_merged.push_back(current);
+			weightSoFar += current.weight;
+			current = next;
+		}
+	};
+
+	m_merged.clear();
+	std::size_t c = 0, b = 0;
+	while (c < m_centroids.size() || b < m_buffer.size())
+	{
+		if (b == m_buffer.size() || (c < m_centroids.size() && m_centroids[c].mean <= m_buffer[b]))
+		{
+			append(m_centroids[c++]);
+		}
+		else
+		{
+			Centroid sample = {m_buffer[b++], 1};
+			append(sample);
+		}
+	}
+	m_merged.push_back(current);
+
+	m_centroids.swap(m_merged);
+	m_totalWeight = total;
+	m_buffer.clear();
+}
+
+double CLQuantileDigest::quantile(double q) const
+{
+	std::vector<double> out;
+	quantiles(std::vector<double>(1, q), out);
+	return out[0];
+}
+
+void CLQuantileDigest::quantiles(const std::vector<double>& qs, std::vector<double>& out) const
+{
+	out.resize(qs.size());
+	if (m_centroids.empty())
+	{
+		std::fill(out.begin(), out.end(), 0);
+		return;
+	}
+
+	// Each centroid's mean sits at the middle of its weight, interpolate linearly between the middles.
+	// Below the first and above the last centroid interpolate towards the extremes.
+	std::size_t i = 0;
+	double before = 0; // weight of centroids before i
+	for (std::size_t k = 0; k < qs.size(); ++k)
+	{
+		double target = std::min(std::max(qs[k], 0.0), 1.0) * m_totalWeight;
+
+		while (i + 1 < m_centroids.size() && before + m_centroids[i].weight + m_centroids[i+1].weight / 2 < target)
+		{
+			before += m_centroids[i].weight;
+			i++;
+		}
+
+		const Centroid& left = m_centroids[i];
+		double leftCenter = before + left.weight / 2;
+
+		double x0, x1, w0, w1;
+		if (target <= leftCenter) // only possible for the first centroid
+		{
+			x0 = m_min;
+			w0 = 0;
+			x1 = left.mean;
+			w1 = leftCenter;
+		}
+		else if (i + 1 < m_centroids.size())
+		{
+			x0 = left.mean;
+			w0 = leftCenter;
+			x1 = m_centroids[i+1].mean;
+			w1 = before + left.weight + m_centroids[i+1].weight / 2;
+		}
+		else
+		{
+			x0 = left.mean;
+			w0 = leftCenter;
+			x1 = m_max;
+			w1 = m_totalWeight;
+		}
+		out[k] = w1 > w0 ? x0 + (x1 - x0) * (target - w0) / (w1 - w0) : x1;
+	}
+}
+
+CLSensor::CLSensor(int totalSize, int windowSize)
+	: m_totalSize(totalSize)
+	, m_windowSize(windowSize)
+	, m_samplesSinceRefresh(0)
+{
+	int effectiveSize = m_totalSize - m_windowSize + 1;
+	if (effectiveSize <= 0 || m_windowSize <= 0)
+		throw std::runtime_error("Sensor window size is too large!");
+
+	// Bucket i holds values between quantiles i/effectiveSize and (i+1)/effectiveSize
+	for (int i = 0; i < effectiveSize; ++i)
+		m_histogramQuantiles.push_back(double(i + 1) / effectiveSize);
+}
+
+void CLSensor::learn(double value)
+{
+	static const std::size_t REFRESH_INTERVAL = 100; // samples between boundary updates
+
+	m_digest.add(value);
+	m_samplesSinceRefresh++;
+
+	if (m_histogram.empty() ? m_digest.count() >= WARMUP_SAMPLES : m_samplesSinceRefresh >= REFRESH_INTERVAL)
+		refreshHistogram();
+}
+
+void CLSensor::refreshHistogram()
+{
+	m_digest.merge();
+	m_digest.quantiles(m_histogramQuantiles, m_histogram);
+	m_samplesSinceRefresh = 0;
+}
+
+int CLSensor::bucket(double value) const
+{
+	if (m_histogram.empty())
+		return -1;
+
+	// First boundary at or above value, values above every boundary go to the last bucket
+	int idx = std::lower_bound(m_histogram.begin(), m_histogram.end(), value) - m_histogram.begin();
+	return std::min(idx, int(m_histogram.size()) - 1);
+}
+
+int CLSensor::observe(double value)
+{
+	learn(value);
+	return bucket(value);
+}
+
+std::vector<signed char> CLSensor::encode(double value)
+{
+	std::vector<signed char> ret(m_totalSize);
+	encode(value, ret.data());
+	return ret;
+}
+
+void CLSensor::encode(double value, signed char* out)
+{
+	int start = observe(value);
+
+	std::fill(out, out + m_totalSize, 0);
+	if (start >= 0)
+		std::fill(out + start, out + start + m_windowSize, 1);
+}
+
+void CLSensor::encodeMany(const std::vector<double>& values, std::uint64_t* out)
+{
+	encodeMany(values.data(), values.size(), out);
+}
+
+void CLSensor::encodeMany(const double* values, std::size_t valueCount, std::uint64_t* out)
+{
+	std::size_t words = packedWords();
+	for (std::size_t i = 0; i < valueCount; ++i)
+	{
+		int start = observe(values[i]);
+
+		std::uint64_t* sdr = out + i * words;
+		std::fill(sdr, sdr + words, 0);
+		if (start < 0)
+			continue;
+
+		// Set the window a word at a time
+		int end = start + m_windowSize;
+		for (int bit = start; bit < end; )
+		{
+			int offset = bit % 64;
+			int count = std::min(64 - offset, end - bit);
+			std::uint64_t mask = count == 64 ? ~std::uint64_t(0) : ((std::uint64_t(1) << count) - 1);
+			sdr[bit / 64] |= mask << offset;
+			bit += count;
+		}
+	}
+}
+
+double CLSensor::decode(const std::vector<double>& sdr)
+{
+	if (m_histogram.empty()) return 0;
+
+	// Overlap of the window starting at i is prefixSum[i+w] - prefixSum[i]
+	int size = std::min(int(sdr.size()), m_totalSize);
+	m_prefixSum.resize(size + 1);
+	m_prefixSum[0] = 0;
+	for (int i = 0; i < size; ++i)
+		m_prefixSum[i+1] = m_prefixSum[i] + sdr[i];
+
+	double highestOverlap = -1;
+	int highestOverlapIndex = 0;
+	for (int i = 0; i + m_windowSize <= size; ++i)
+	{
+		double overlap = m_prefixSum[i+m_windowSize] - m_prefixSum[i];
+		if (overlap > highestOverlap)
+		{
+			highestOverlap = overlap;
+			highestOverlapIndex = i;
+		}
+	}
+	return m_histogram[highestOverlapIndex];
+}
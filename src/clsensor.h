@@ -0,0 +1,104 @@
+#ifndef CLSENSOR_H_INCLUDED
+#define CLSENSOR_H_INCLUDED
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Streaming quantile estimate (merging t-digest). Samples are buffered and merged into a bounded
+// number of centroids, so memory stays constant no matter how many samples are added.
+class CLQuantileDigest
+{
+private:
+	struct Centroid
+	{
+		double mean;
+		double weight;
+	};
+
+	double m_compression;
+	std::vector<Centroid> m_centroids;
+	std::vector<Centroid> m_merged; // scratch space for merge()
+	std::vector<double> m_buffer;
+	std::size_t m_bufferSize;
+	double m_totalWeight;
+	double m_min;
+	double m_max;
+
+	// Scale function bounding the size of centroids, small near the tails and large near the median
+	double scale(double q) const;
+
+public:
+
+	CLQuantileDigest(double compression = 100);
+
+	void add(double value);
+	// Fold buffered samples into the centroids. Called automatically when the buffer fills up.
+	void merge();
+
+	// Value below which a fraction q of the samples fall. Buffered samples are not included.
+	double quantile(double q) const;
+	// Evaluate quantiles for ascending qs in one pass
+	void quantiles(const std::vector<double>& qs, std::vector<double>& out) const;
+
+	double count() const
+	{
+		return m_totalWeight + m_buffer.size();
+	}
+};
+
+// Encodes scalars to SDRs of totalSize bits with windowSize consecutive bits set, and back.
+// Bucket boundaries follow the quantiles of the values seen so far, so every bucket is used about
+// equally often. The boundaries keep adapting as the digest merges new samples.
+class CLSensor
+{
+	static const int WARMUP_SAMPLES = 1000; // samples to collect before the first boundaries are set
+private:
+
+	int m_totalSize;
+	int m_windowSize;
+	CLQuantileDigest m_digest;
+	std::vector<double> m_histogram; // totalSize - windowSize + 1 ascending bucket boundaries
+	std::vector<double> m_histogramQuantiles;
+	std::vector<double> m_prefixSum; // scratch space for decode()
+	std::size_t m_samplesSinceRefresh;
+
+	void learn(double value);
+	void refreshHistogram();
+
+public:
+
+	CLSensor(int totalSize, int windowSize);
+
+	// Learn from value and return the window start of its bucket, -1 while warming up. encode() sets the window.
+	int observe(double value);
+
+	std::vector<signed char> encode(double value);
+	void encode(double value, signed char* out);
+
+	// Encode values one after another into packed SDRs of packedWords() words each, bit i of an SDR
+	// in word i/64. out must hold values.size() * packedWords() words.
+	void encodeMany(const std::vector<double>& values, std::uint64_t* out);
+	void encodeMany(const double* values, std::size_t valueCount, std::uint64_t* out);
+	std::size_t packedWords() const
+	{
+		return (m_totalSize + 63) / 64;
+	}
+
+	// Boundary of the bucket whose window overlaps sdr the most
+	double decode(const std::vector<double>& sdr);
+
+	// Window start of the bucket containing value, or -1 while warming up. Buckets can be fed to a CLClassifier.
+	int bucket(double value) const;
+	int bucketCount() const
+	{
+		return m_totalSize - m_windowSize + 1;
+	}
+
+	const std::vector<double>& getHistogram() const
+	{
+		return m_histogram;
+	}
+};
+
+#endif
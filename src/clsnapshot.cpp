@@ -0,0 +1,360 @@
+#include "clsnapshot.h"
+#include "clregion.h"
+
+#include <algorithm>
+
+namespace
+{
+	const std::uint32_t RECORD_MAGIC = 0x52534c43; // "CLSR"
+
+	// Record layout, all fields in host byte order:
+	//   u64 length, then length bytes of body:
+	//     u32 magic, u32 sourceCount, u64 sequence
+	//     per source: i32 id, u64 byteSize, u32 runCount, then per run: u64 offset, u64 length, bytes
+	//   u64 checksum of the body
+
+	std::uint64_t checksum(const std::vector<char>& data)
+	{
+		// FNV-1a
+		std::uint64_t hash = 14695981039346656037ull;
+		for (char c : data)
+		{
+			hash ^= std::uint8_t(c);
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	template <class T>
+	void put(std::vector<char>& record, T value)
+	{
+		const char* bytes = reinterpret_cast<const char*>(&value);
+		record.insert(record.end(), bytes, bytes + sizeof(T));
+	}
+
+	template <class T>
+	bool get(const std::vector<char>& record, std::size_t& position, T& value)
+	{
+		if (record.size() - position < sizeof(T))
+			return false;
+		std::memcpy(&value, &record[position], sizeof(T));
+		position += sizeof(T);
+		return true;
+	}
+
+	// Parse a record whose checksum matched. Only checks the layout while image is null, so a record is
+	// applied to the image once it is known to be whole.
+	bool readRecord(const std::vector<char>& record, std::uint64_t& sequence, CLSnapshotImage* image)
+	{
+		std::size_t position = 0;
+		std::uint32_t magic, sourceCount;
+		if (!get(record, position, magic) || magic != RECORD_MAGIC || !get(record, position, sourceCount) || !get(record, position, sequence))
+			return false;
+
+		for (std::uint32_t s = 0; s < sourceCount; ++s)
+		{
+			std::int32_t id;
+			std::uint64_t byteSize;
+			std::uint32_t runCount;
+			if (!get(record, position, id) || !get(record, position, byteSize) || !get(record, position, runCount))
+				return false;
+
+			std::vector<char>* data = nullptr;
+			if (image)
+			{
+				data = &image->sources[id];
+				data->resize(byteSize);
+			}
+			for (std::uint32_t r = 0; r < runCount; ++r)
+			{
+				std::uint64_t offset, length;
+				if (!get(record, position, offset) || !get(record, position, length) ||
+					offset > byteSize || length > byteSize - offset || length > record.size() - position)
+					return false;
+				if (data)
+					std::memcpy(&(*data)[offset], &record[position], length);
+				position += length;
+			}
+		}
+		return position == record.size();
+	}
+
+	std::size_t dirtyWords(const CLSnapshotSource& source)
+	{
+		std::size_t blocks = (source.byteSize + source.blockSize - 1) / source.blockSize;
+		return (blocks + 31) / 32;
+	}
+}
+
+CLSnapshotter::CLSnapshotter(CLRegion& region, const std::string& path)
+	: m_region(region)
+	, m_context(region.context().fork())
+	, m_log(path.c_str(), std::ios::binary | std::ios::app)
+	, m_nextSlot(0)
+	, m_sequence(0)
+	, m_zeroWords(0)
+	, m_stop(false)
+{
+	if (!m_log)
+		throw std::runtime_error("Failed to open snapshot log!");
+
+	for (Slot& slot : m_slots)
+		slot.busy = false;
+
+	m_worker = std::thread(&CLSnapshotter::run, this);
+}
+
+CLSnapshotter::~CLSnapshotter()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_condition.notify_all();
+	m_worker.join();
+}
+
+void CLSnapshotter::snapshot()
+{
+	Slot& slot = m_slots[m_nextSlot];
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_condition.wait(lock, [&] { return !slot.busy || m_error; });
+		if (m_error)
+			std::rethrow_exception(m_error);
+	}
+
+	slot.sources.clear();
+	m_region.snapshotSources(slot.sources);
+	slot.sequence = ++m_sequence;
+
+	std::size_t count = slot.sources.size();
+	slot.copies.resize(count);
+	slot.dirtyCopies.resize(count);
+	slot.copySizes.resize(count, 0);
+	slot.dirtyBlocks.resize(count);
+	slot.complete.resize(count);
+
+	// Copy on the region's own queue, ordered after the work already submitted
+	CLContext& context = m_region.context();
+	context.barrier();
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		const CLSnapshotSource& source = slot.sources[i];
+		slot.complete[i] = true;
+		if (!source.hostData.empty())
+			continue;
+
+		if (slot.copySizes[i] != source.byteSize)
+		{
+			slot.copies[i] = cl::Buffer(context.nativeContext(), CL_MEM_READ_WRITE, source.byteSize);
+			slot.copySizes[i] = source.byteSize;
+		}
+		context.queue().enqueueCopyBuffer(source.buffer, slot.copies[i], 0, 0, source.byteSize);
+
+		// Buffers are written in full the first time and whenever their size changed
+		auto last = m_lastSizes.find(source.id);
+		bool resized = last == m_lastSizes.end() || last->second != source.byteSize;
+		m_lastSizes[source.id] = source.byteSize;
+		if (source.blockSize == 0)
+			continue;
+		slot.complete[i] = resized;
+
+		std::size_t words = dirtyWords(source);
+		if (slot.dirtyBlocks[i].size() != words)
+		{
+			slot.dirtyCopies[i] = cl::Buffer(context.nativeContext(), CL_MEM_READ_WRITE, words * sizeof(cl_uint));
+			slot.dirtyBlocks[i].resize(words);
+		}
+		if (m_zeroWords < words)
+		{
+			std::vector<cl_uint> zeros(words, 0);
+			m_zeros = cl::Buffer(context.nativeContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, words * sizeof(cl_uint), zeros.data());
+			m_zeroWords = words;
+		}
+
+		// Hand the bitmap over to the snapshot and start tracking the next one
+		std::vector<cl::Event> handedOver(1);
+		context.queue().enqueueCopyBuffer(source.dirtyBlocks, slot.dirtyCopies[i], 0, 0, words * sizeof(cl_uint), nullptr, &handedOver[0]);
+		context.queue().enqueueCopyBuffer(m_zeros, source.dirtyBlocks, 0, 0, words * sizeof(cl_uint), &handedOver);
+	}
+	context.queue().enqueueMarkerWithWaitList(nullptr, &slot.copied);
+	context.queue().flush();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		slot.busy = true;
+		m_pending.push_back(m_nextSlot);
+	}
+	m_condition.notify_all();
+	m_nextSlot ^= 1;
+}
+
+void CLSnapshotter::flush()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_condition.wait(lock, [&] { return m_pending.empty() || m_error; });
+	if (m_error)
+		std::rethrow_exception(m_error);
+}
+
+void CLSnapshotter::run()
+{
+	for (;;)
+	{
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [&] { return m_stop || !m_pending.empty(); });
+			if (m_pending.empty())
+				return;
+			index = m_pending.front();
+		}
+
+		try
+		{
+			write(m_slots[index]);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_error)
+				m_error = std::current_exception();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending.pop_front();
+			m_slots[index].busy = false;
+		}
+		m_condition.notify_all();
+	}
+}
+
+void CLSnapshotter::write(Slot& slot)
+{
+	cl::CommandQueue& queue = m_context->queue();
+	std::vector<cl::Event> copied(1, slot.copied);
+
+	// The bitmaps decide which blocks to download
+	for (std::size_t i = 0; i < slot.sources.size(); ++i)
+	{
+		if (!slot.complete[i])
+			queue.enqueueReadBuffer(slot.dirtyCopies[i], CL_FALSE, 0, slot.dirtyBlocks[i].size() * sizeof(cl_uint), slot.dirtyBlocks[i].data(), &copied);
+	}
+	queue.finish();
+
+	struct Run
+	{
+		std::size_t source;
+		std::uint64_t offset;
+		std::uint64_t length;
+		std::size_t position; // in the record
+	};
+	std::vector<Run> runs;
+
+	// Lay out the record, merging neighbouring dirty blocks into one run
+	std::vector<char>& record = slot.record;
+	record.clear();
+	put(record, RECORD_MAGIC);
+	put(record, std::uint32_t(slot.sources.size()));
+	put(record, std::uint64_t(slot.sequence));
+	for (std::size_t i = 0; i < slot.sources.size(); ++i)
+	{
+		const CLSnapshotSource& source = slot.sources[i];
+		std::size_t firstRun = runs.size();
+		if (slot.complete[i])
+		{
+			Run run = {i, 0, source.byteSize, 0};
+			runs.push_back(run);
+		}
+		else
+		{
+			std::size_t blocks = (source.byteSize + source.blockSize - 1) / source.blockSize;
+			for (std::size_t b = 0; b < blocks; ++b)
+			{
+				if (!(slot.dirtyBlocks[i][b / 32] & (1u << (b % 32))))
+					continue;
+				std::uint64_t offset = b * source.blockSize;
+				std::uint64_t length = std::min<std::uint64_t>(source.blockSize, source.byteSize - offset);
+				if (runs.size() > firstRun && runs.back().offset + runs.back().length == offset)
+				{
+					runs.back().length += length;
+				}
+				else
+				{
+					Run run = {i, offset, length, 0};
+					runs.push_back(run);
+				}
+			}
+		}
+
+		put(record, std::int32_t(source.id));
+		put(record, std::uint64_t(source.byteSize));
+		put(record, std::uint32_t(runs.size() - firstRun));
+		for (std::size_t r = firstRun; r < runs.size(); ++r)
+		{
+			put(record, runs[r].offset);
+			put(record, runs[r].length);
+			runs[r].position = record.size();
+			record.resize(record.size() + runs[r].length);
+		}
+	}
+
+	// Download the runs straight into the record
+	for (const Run& run : runs)
+	{
+		const CLSnapshotSource& source = slot.sources[run.source];
+		if (!source.hostData.empty())
+			std::memcpy(&record[run.position], source.hostData.data(), run.length);
+		else
+			queue.enqueueReadBuffer(slot.copies[run.source], CL_FALSE, run.offset, run.length, &record[run.position], &copied);
+	}
+	queue.finish();
+
+	std::uint64_t length = record.size();
+	std::uint64_t sum = checksum(record);
+	m_log.write(reinterpret_cast<const char*>(&length), sizeof(length));
+	m_log.write(record.data(), record.size());
+	m_log.write(reinterpret_cast<const char*>(&sum), sizeof(sum));
+	m_log.flush();
+	if (!m_log)
+		throw std::runtime_error("Failed to write snapshot log!");
+}
+
+bool CLSnapshotter::load(const std::string& path, CLSnapshotImage& image)
+{
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in)
+		return false;
+
+	in.seekg(0, std::ios::end);
+	std::uint64_t remaining = in.tellg();
+	in.seekg(0, std::ios::beg);
+
+	bool loaded = false;
+	std::vector<char> record;
+	for (;;)
+	{
+		// Stop at the first record that is incomplete or damaged, everything before it is consistent
+		std::uint64_t length, sum;
+		if (remaining < 2 * sizeof(std::uint64_t) || !in.read(reinterpret_cast<char*>(&length), sizeof(length)))
+			break;
+		remaining -= 2 * sizeof(std::uint64_t);
+		if (length > remaining)
+			break;
+		record.resize(length);
+		if (!in.read(record.data(), length) || !in.read(reinterpret_cast<char*>(&sum), sizeof(sum)) || sum != checksum(record))
+			break;
+		remaining -= length;
+
+		std::uint64_t sequence;
+		if (!readRecord(record, sequence, nullptr))
+			break;
+		readRecord(record, sequence, &image);
+
+		image.sequence = sequence;
+		loaded = true;
+	}
+	return loaded;
+}
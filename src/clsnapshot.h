@@ -0,0 +1,148 @@
+#ifndef CLSNAPSHOT_H_INCLUDED
+#define CLSNAPSHOT_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <memory>
+
+#include "clcontext.h"
+#include "clbuffer.h"
+
+// Part of a region's state as seen by a snapshot: a device buffer, optionally tracked in blocks through a
+// bitmap that the kernels set when they change a block, or a copy of host state
+struct CLSnapshotSource
+{
+	int id; // identifies the source in the log, stable across runs
+	const char* name;
+	cl::Buffer buffer;
+	std::size_t byteSize;
+	std::size_t elementSize;
+	std::size_t blockSize; // bytes per tracked block, 0 for buffers copied in full
+	cl::Buffer dirtyBlocks; // one bit per block
+	std::vector<char> hostData; // used instead of buffer for host state
+
+	template <class T>
+	static CLSnapshotSource full(int id, const char* name, CLBuffer<T>& data)
+	{
+		CLSnapshotSource ret = {id, name, data.buffer(), data.byteSize(), sizeof(T), 0, cl::Buffer(), std::vector<char>()};
+		return ret;
+	}
+	template <class T>
+	static CLSnapshotSource blocks(int id, const char* name, CLBuffer<T>& data, std::size_t blockLength, CLBuffer<cl_uint>& dirtyBlocks)
+	{
+		CLSnapshotSource ret = {id, name, data.buffer(), data.byteSize(), sizeof(T), blockLength * sizeof(T), dirtyBlocks.buffer(), std::vector<char>()};
+		return ret;
+	}
+	template <class T>
+	static CLSnapshotSource host(int id, const char* name, const T& state)
+	{
+		const char* bytes = reinterpret_cast<const char*>(&state);
+		CLSnapshotSource ret = {id, name, cl::Buffer(), sizeof(T), 1, 0, cl::Buffer(), std::vector<char>(bytes, bytes + sizeof(T))};
+		return ret;
+	}
+};
+
+// State reconstructed from a snapshot log, by source id
+struct CLSnapshotImage
+{
+	std::uint64_t sequence; // number of the last snapshot applied
+	std::map<int, std::vector<char> > sources;
+
+	// Copy a source into a buffer of the same size and upload it
+	template <class T>
+	void restore(int id, CLBuffer<T>& data) const
+	{
+		const std::vector<char>& bytes = source(id, data.byteSize());
+		std::memcpy(&data[0], bytes.data(), bytes.size());
+		data.enqueueWrite(false);
+	}
+	template <class T>
+	void restore(int id, T& state) const
+	{
+		const std::vector<char>& bytes = source(id, sizeof(T));
+		std::memcpy(&state, bytes.data(), bytes.size());
+	}
+	const std::vector<char>& source(int id, std::size_t byteSize) const
+	{
+		auto found = sources.find(id);
+		if (found == sources.end() || found->second.size() != byteSize)
+			throw std::runtime_error("Snapshot does not match the region configuration!");
+		return found->second;
+	}
+};
+
+class CLRegion;
+
+// Periodic snapshots of a region, appended to a log file as deltas. Each snapshot copies the region's
+// buffers on the device behind the work already queued, which does not stall the region. A worker
+// thread then downloads only the blocks that changed since the previous snapshot through a queue of
+// its own and appends them to the log. Every record carries a checksum, so a record torn by a crash is
+// detected and load() stops at the last complete snapshot.
+//
+// The first snapshot and snapshots after a buffer was resized copy everything. snapshot() must be called
+// from the thread that steps the region, it only blocks while the two snapshot slots are both in flight.
+class CLSnapshotter
+{
+private:
+	struct Slot
+	{
+		std::vector<CLSnapshotSource> sources;
+		std::vector<cl::Buffer> copies; // device copies of the sources
+		std::vector<cl::Buffer> dirtyCopies;
+		std::vector<std::size_t> copySizes;
+		std::vector< std::vector<cl_uint> > dirtyBlocks; // downloaded bitmaps
+		std::vector<bool> complete; // source is written in full
+		std::vector<char> record;
+		cl::Event copied;
+		std::uint64_t sequence;
+		bool busy;
+	};
+
+	CLRegion& m_region;
+	std::unique_ptr<CLContext> m_context; // secondary queue for the downloads
+	std::ofstream m_log;
+
+	Slot m_slots[2];
+	int m_nextSlot;
+	std::uint64_t m_sequence;
+	std::map<int, std::size_t> m_lastSizes; // byte size of each source in the previous snapshot
+	cl::Buffer m_zeros; // clears the dirty bitmaps
+	std::size_t m_zeroWords;
+
+	std::thread m_worker;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::deque<int> m_pending; // slots waiting for the worker
+	bool m_stop;
+	std::exception_ptr m_error;
+
+	void run();
+	void write(Slot& slot);
+
+public:
+	CLSnapshotter(CLRegion& region, const std::string& path);
+	~CLSnapshotter();
+
+	CLSnapshotter(const CLSnapshotter&) = delete;
+	CLSnapshotter& operator=(const CLSnapshotter&) = delete;
+
+	// Capture the region's state after the work queued so far
+	void snapshot();
+	// Wait until every snapshot taken so far is in the log. Rethrows errors of the worker.
+	void flush();
+
+	// Replay a log up to its last complete record. Returns false if it holds no complete snapshot.
+	static bool load(const std::string& path, CLSnapshotImage& image);
+};
+
+#endif
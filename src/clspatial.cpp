@@ -4,9 +4,18 @@
 #include <cassert>
 #include <random>
 #include <sstream>
+#include <algorithm>
 
 #include "clregion.h"
+#include "clrandom.h"
+#include "clspecialization.h"
 
+constexpr static const char* RANDOM_STREAMS_SRC =
+#include "randomstreams.cl.h"
+;
+constexpr static const char* RANDOM_SRC =
+#include "random.cl.h"
+;
 constexpr static const char* SPATIAL_SRC =
 #include "spatial.cl.h"
 ;
@@ -18,45 +27,156 @@ CLSpatialPooler::CLSpatialPooler(CLContext& context, const CLTopology& topo, con
 	, m_columnData(context, m_topology.getColumns())
 	, m_synapseData(context, m_topology.getColumns() * args.ColumnProximalSynapseCount)
 	, m_inputData(context, m_topology.getInputSize())
-	, m_refineCounter(0)
+	, m_spanData(context, 4)
+	, m_rowMaxData(context, m_topology.getColumns())
+	, m_backwardsInput(context, m_topology.getColumns())
+	, m_backwardsResult(context, m_topology.getInputSize())
+	, m_dirtyData(context, ((m_topology.getColumns() + std::max(args.SnapshotBlockSize, 1) - 1) / std::max(args.SnapshotBlockSize, 1) + 31) / 32)
+	, m_neighbourOffsetData(context, m_topology.getColumns() + 1)
+	, m_neighbourData(context, 1)
+	, m_receptiveFieldOffsetData(context, topo.lists && !topo.lists->receptiveFieldOffsets.empty() ? topo.lists->receptiveFieldOffsets.size() : 1)
+	, m_receptiveFieldData(context, topo.lists && !topo.lists->receptiveFields.empty() ? topo.lists->receptiveFields.size() : 1)
+	, m_resetCountData(context, 1)
+	, m_resetCount(0)
+	, m_refineOffset(0)
+	, m_refineSliceSize(std::min(m_topology.getColumns(), args.RefineSliceSize > 0 ? args.RefineSliceSize : (m_topology.getColumns() + 99) / 100))
+	, m_inhibitionTileSize(0)
+	, m_rowSegmentSize(0)
+	, m_columnSegmentSize(0)
+	, m_inhibitionRadius(topo.inhibitionRadius)
+	, m_neighbourListRadius(-2)
+	, m_randomKey(CLRandom::makeKey(args.RandomSeed))
+	, m_step(0)
 {
 	std::cerr << "CLSpatialPooler: Initializing" << std::endl;
 
+	if (args.SnapshotBlockSize <= 0)
+	{
+		throw std::runtime_error("Invalid snapshot block size!");
+	}
+	topo.validate();
+
 	// Install kernel programs
 	std::string definitions = args.serialize() + topo.serialize();
+	cl::Program program = context.buildProgram({definitions, RANDOM_STREAMS_SRC, RANDOM_SRC, "\n#line 1\n", SPATIAL_SRC}, CLSpecialization(context.device(), args).buildOptions());
 
-	cl::Program::Sources sources;
-	sources.push_back({definitions.c_str(), definitions.length()});
-	sources.push_back({SPATIAL_SRC, strlen(SPATIAL_SRC)});
+	cl::Device& device = context.device();
+	int regionRows = m_topology.regionHeight * m_topology.regionDepth;
+	m_computeOverlapKernel = CLKernel(program, "computeOverlap");
+	m_computeOverlapKernel.setRange(device, m_topology.getColumns());
 
-	cl::Program program(context.nativeContext(), sources);
-	try
+	// Inhibition runs in tiles: wide ones for lines, square ones for 2D regions, as large as the device allows
+	m_inhibitNeighboursKernel = CLKernel(program, "inhibitNeighbours");
+	std::size_t maxTileSize = m_inhibitNeighboursKernel.workGroupSize(device);
+	std::size_t tileWidth = regionRows == 1 ? 256 : 16;
+	std::size_t tileHeight = regionRows == 1 ? 1 : 16;
+	while (tileWidth * tileHeight > maxTileSize)
 	{
-		program.build({context.device()});
+		if (tileHeight > 1)
+			tileHeight /= 2;
+		if (tileWidth * tileHeight > maxTileSize)
+			tileWidth /= 2;
 	}
-	catch(const cl::Error& err)
+	m_inhibitionTileSize = tileWidth * tileHeight;
+	m_inhibitNeighboursKernel.setRange(
+		cl::NDRange(
+			(m_topology.regionWidth + tileWidth - 1) / tileWidth * tileWidth,
+			(regionRows + tileHeight - 1) / tileHeight * tileHeight),
+		cl::NDRange(tileWidth, tileHeight));
+
+	// The max filter passes run along rows and columns in segments of up to 256 columns
+	auto segmentSize = [&](const CLKernel& kernel, int length)
 	{
-		std::cerr << "Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(context.device()) << std::endl;
-		throw;
-	}
+		std::size_t size = 256;
+		while (size > 1 && (size > kernel.workGroupSize(device) || int(size / 2) >= length))
+			size /= 2;
+		return size;
+	};
+	m_maxDutyCycleRowsKernel = CLKernel(program, "maxDutyCycleRows");
+	m_computeMinDutyCyclesKernel = CLKernel(program, "computeMinDutyCycles");
+	m_rowSegmentSize = segmentSize(m_maxDutyCycleRowsKernel, m_topology.regionWidth);
+	m_columnSegmentSize = segmentSize(m_computeMinDutyCyclesKernel, regionRows);
+	m_maxDutyCycleRowsKernel.setRange(
+		cl::NDRange((m_topology.regionWidth + m_rowSegmentSize - 1) / m_rowSegmentSize * m_rowSegmentSize, regionRows),
+		cl::NDRange(m_rowSegmentSize, 1));
+	m_computeMinDutyCyclesKernel.setRange(
+		cl::NDRange(m_topology.regionWidth, (regionRows + m_columnSegmentSize - 1) / m_columnSegmentSize * m_columnSegmentSize),
+		cl::NDRange(1, m_columnSegmentSize));
 
-	m_computeOverlapKernel = cl::KernelFunctor(cl::Kernel(program, "computeOverlap"), context.queue(), cl::NullRange, cl::NDRange(m_topology.getColumns()), cl::NullRange);
-	m_inhibitNeighboursKernel = cl::KernelFunctor(cl::Kernel(program, "inhibitNeighbours"), context.queue(), cl::NullRange, cl::NDRange(m_topology.getColumns()), cl::NullRange);
-	m_updatePermanencesKernel = cl::KernelFunctor(cl::Kernel(program, "updatePermanences"), context.queue(), cl::NullRange, cl::NDRange(m_topology.getColumns()), cl::NullRange);
-	m_refineRegionKernel = cl::KernelFunctor(cl::Kernel(program, "refineRegion"), context.queue(), cl::NullRange, cl::NDRange(m_topology.getColumns()), cl::NullRange);
+	// Volumes, wrapped grids and graphs are inhibited over neighbour lists instead
+	m_inhibitNeighbourListKernel = CLKernel(program, "inhibitNeighbourList");
+	m_inhibitNeighbourListKernel.setRange(device, m_topology.getColumns());
+	m_computeMinDutyCycleListKernel = CLKernel(program, "computeMinDutyCycleList");
+	m_computeMinDutyCycleListKernel.setRange(device, m_topology.getColumns());
 
-	// Initialize region
-	cl::KernelFunctor initRegion =
-	cl::KernelFunctor(cl::Kernel(program, "initRegion"), context.queue(),
-		cl::NullRange, cl::NDRange(m_topology.getColumns()), cl::NullRange);
+	m_updateDutyCyclesKernel = CLKernel(program, "updateDutyCycles");
+	m_updateDutyCyclesKernel.setRange(device, m_topology.getColumns());
+	m_updatePermanencesKernel = CLKernel(program, "updatePermanences");
+	m_updatePermanencesKernel.setRange(device, m_topology.getColumns());
+	m_refineRegionKernel = CLKernel(program, "refineRegion");
+	m_refineRegionKernel.setRange(device, m_refineSliceSize);
+	m_measureReceptiveFieldsKernel = CLKernel(program, "measureReceptiveFields");
+	m_measureReceptiveFieldsKernel.setRange(device, m_topology.getColumns());
+	m_backwardsKernel = CLKernel(program, "backwards");
+	m_clearBackwardsKernel = CLKernel(program, "clearBackwards");
 
-	cl_uint2 randomState;
-	randomState.s[0] = rand();
-	randomState.s[1] = rand();
-	initRegion(m_columnData.buffer(), m_synapseData.buffer(), randomState);
+	// A step is the same chain of launches every time, only refinement is skipped on some steps
+	// Phase 1: Overlap
+	int overlapNode = m_stepGraph.add(m_computeOverlapKernel);
+	// Phase 2: Inhibit neighbours
+	m_gridInhibitionNodes.push_back(m_stepGraph.add(m_inhibitNeighboursKernel));
+	// Phase 3: Boost columns that fall behind the most active column of their neighbourhood
+	m_gridInhibitionNodes.push_back(m_stepGraph.add(m_maxDutyCycleRowsKernel));
+	m_gridInhibitionNodes.push_back(m_stepGraph.add(m_computeMinDutyCyclesKernel));
+	// Phases 2 and 3 over neighbour lists
+	m_listInhibitionNodes.push_back(m_stepGraph.add(m_inhibitNeighbourListKernel, {overlapNode}));
+	m_listInhibitionNodes.push_back(m_stepGraph.add(m_computeMinDutyCycleListKernel));
+	// Phase 4: Update duty cycles and boosts, then permanences on learning steps
+	m_stepGraph.add(m_updateDutyCyclesKernel, {m_gridInhibitionNodes.back(), m_listInhibitionNodes.back()});
+	m_updatePermanencesNode = m_stepGraph.add(m_updatePermanencesKernel);
+	// Extra: Refine the next slice of the region
+	m_refineNode = m_stepGraph.add(m_refineRegionKernel);
+
+	// Receptive field lists are uploaded once, neighbour lists whenever the inhibition radius changes
+	if (topo.lists && !topo.lists->receptiveFieldOffsets.empty())
+	{
+		m_receptiveFieldOffsetData.enqueueWrite(false, topo.lists->receptiveFieldOffsets);
+		m_receptiveFieldData.enqueueWrite(false, topo.lists->receptiveFields);
+	}
+	updateNeighbourLists();
+	bindKernels();
+
+	// Initialize region
+	CLKernel initRegion(program, "initRegion");
+	initRegion.setRange(device, m_topology.getColumns());
+	initRegion.bind(m_columnData.buffer(), m_synapseData.buffer(), m_receptiveFieldOffsetData.buffer(), m_receptiveFieldData.buffer(), m_randomKey, m_step);
+	initRegion.launch(context);
+	m_dirtyData.enqueueWrite(false);
+	m_resetCountData.enqueueWrite(false);
 
 	std::cerr << "CLSpatialPooler: Kernels loaded" << std::endl;
 }
+void CLSpatialPooler::addBuffers(const CLTopology& topo, const CLArgs& args, CLPoolSizePlanner& planner)
+{
+	std::size_t columns = topo.getColumns();
+	std::size_t blockSize = std::max(args.SnapshotBlockSize, 1);
+
+	planner.add("Columns", columns * sizeof(CLColumn));
+	planner.add("Proximal synapses", columns * args.ColumnProximalSynapseCount * sizeof(CLSynapse));
+	planner.add("Spatial input", topo.getInputSize() * sizeof(cl_char));
+	planner.add("Receptive field spans", 4 * sizeof(cl_int));
+	planner.add("Row duty cycle maxima", columns * sizeof(cl_float));
+	planner.add("Backwards input", columns * sizeof(cl_char)); // grows with the batch size of backwards()
+	planner.add("Backwards result", topo.getInputSize() * sizeof(cl_int));
+	planner.add("Proximal dirty blocks", ((columns + blockSize - 1) / blockSize + 31) / 32 * sizeof(cl_uint));
+	planner.add("Refine counter", sizeof(cl_uint));
+	// Lists derived from the grid are sized for the initial inhibition radius, an adaptive radius may change them
+	if (topo.usesNeighbourLists(topo.inhibitionRadius))
+		planner.add("Neighbour lists", (columns + 1 + topo.neighbourListSize(topo.inhibitionRadius)) * sizeof(cl_int));
+	if (topo.lists && !topo.lists->receptiveFieldOffsets.empty())
+		planner.add("Receptive field lists", (topo.lists->receptiveFieldOffsets.size() + topo.lists->receptiveFields.size()) * sizeof(cl_int));
+}
+
 std::vector<cl_char> CLSpatialPooler::write(const std::vector<cl_char>& bits)
 {
 	if (bits.size() != std::size_t(m_topology.getInputSize()))
@@ -64,39 +184,178 @@ std::vector<cl_char> CLSpatialPooler::write(const std::vector<cl_char>& bits)
 		throw std::runtime_error("Invalid vector length!");
 	}
 
-	// Send given input pattern to compute device
+	std::vector<cl_char> ret(m_topology.getColumns());
+	write(bits.data(), ret.data());
+	return ret;
+}
+void CLSpatialPooler::write(const cl_char* bits, cl_char* activeColumns)
+{
+	// Send given input pattern to compute device, the step reads back before returning
 	m_inputData.enqueueWrite(false, bits);
+	step(nullptr, activeColumns);
+}
+void CLSpatialPooler::write(CLEncoder& encoder, const double* values, cl_char* activeColumns)
+{
+	if (encoder.size() != m_topology.getInputSize())
+	{
+		throw std::runtime_error("Encoder does not match the input size!");
+	}
 
-	// Phase 1: Overlap
-	m_computeOverlapKernel(m_columnData.buffer(), m_synapseData.buffer(), m_inputData.buffer());
+	// The encoder sets the input bits on the device, only its field windows are uploaded
+	m_encodeEvents.assign(1, encoder.enqueueEncode(values, m_inputData.buffer()));
+	step(&m_encodeEvents, activeColumns);
+}
+void CLSpatialPooler::step(const std::vector<cl::Event>* waitFor, cl_char* activeColumns)
+{
+	m_step++;
 
-	// Phase 2: Inhibit neighbours
-	m_inhibitNeighboursKernel(m_columnData.buffer(), m_synapseData.buffer());
+	// Steps that do not learn only compute the active columns, see CLArgs::LearningInterval
+	bool learn = m_args.learnsAt(m_step);
+	m_stepGraph.setEnabled(m_updatePermanencesNode, learn);
 
-	// Phase 3: Update permanences
-	m_updatePermanencesKernel(m_columnData.buffer(), m_synapseData.buffer(), m_inputData.buffer());
+	// Extra: Refine the next slice of the region (reset bad synapses) every N iterations
+	bool refine = learn && m_args.RefineInterval > 0 && m_step % m_args.RefineInterval == 0;
+	m_stepGraph.setEnabled(m_refineNode, refine);
+	if (refine)
+	{
+		m_refineRegionKernel.setArg(REFINE_FIRST_COLUMN_ARG, m_refineOffset);
+		m_refineRegionKernel.setArg(REFINE_STEP_ARG, m_step);
+		m_refineOffset = (m_refineOffset + m_refineSliceSize) % m_topology.getColumns();
+	}
+	const std::vector<cl::Event>& stepDone = m_stepGraph.run(m_context, waitFor);
 
-	// Extra: Refine region (reset bad synapses) every N iterations
-	if (++m_refineCounter > 100)
+	// Extra: Measure receptive fields every N iterations, read back along with the columns
+	bool measure = m_args.AdaptiveInhibitionRadius && m_args.InhibitionRadiusInterval > 0 && m_step % m_args.InhibitionRadiusInterval == 0;
+	if (measure)
 	{
-		cl_uint2 randomState;
-		randomState.s[0] = rand();
-		randomState.s[1] = rand();
-		m_refineRegionKernel(m_columnData.buffer(), m_synapseData.buffer(), randomState);
-		m_refineCounter = 0;
+		std::fill(m_spanData.begin(), m_spanData.end(), 0);
+		m_spanData.enqueueWrite(false);
+		m_measureReceptiveFieldsKernel.launch(m_context, &stepDone);
+		m_spanData.enqueueRead(false);
 	}
 
+	if (refine)
+		m_resetCountData.enqueueRead(false);
+
 	// Download list of active columns from the compute device
 	m_columnData.enqueueRead(true);
 
-	std::vector<cl_char> ret;
-	ret.reserve(m_topology.getColumns());
+	if (measure)
+		updateInhibitionRadius();
+	if (refine)
+	{
+		m_context.metrics().add(CLMetrics::SYNAPSES_RESET, cl_uint(m_resetCountData[0] - m_resetCount));
+		m_resetCount = m_resetCountData[0];
+	}
+	m_stepGraph.record(m_context.metrics());
+
 	for (CLColumn& col: m_columnData)
-		ret.push_back(col.active);
-	return ret;
+		*activeColumns++ = col.active;
 }
+void CLSpatialPooler::updateInhibitionRadius()
+{
+	int columns = m_spanData[3];
+	if (columns == 0)
+		return;
+
+	// Average span in input space scaled to column space, over the axes the region extends along.
+	// The radius spans the whole neighbourhood, like the receptive field.
+	double spanX = double(m_spanData[0]) / columns * m_topology.regionWidth / m_topology.inputWidth;
+	double spanY = double(m_spanData[1]) / columns * m_topology.regionHeight / m_topology.inputHeight;
+	double spanZ = double(m_spanData[2]) / columns * m_topology.regionDepth / m_topology.inputDepth;
+	double span = spanX;
+	int axes = 1;
+	if (m_topology.regionHeight > 1)
+	{
+		span += spanY;
+		axes++;
+	}
+	if (m_topology.regionDepth > 1)
+	{
+		span += spanZ;
+		axes++;
+	}
+	span /= axes;
+
+	m_inhibitionRadius = std::max(1, int(span + 0.5));
+	updateNeighbourLists();
+	bindKernels();
+}
+
+void CLSpatialPooler::updateNeighbourLists()
+{
+	bool lists = m_topology.usesNeighbourLists(m_inhibitionRadius);
+	for (int node : m_gridInhibitionNodes)
+		m_stepGraph.setEnabled(node, !lists);
+	for (int node : m_listInhibitionNodes)
+		m_stepGraph.setEnabled(node, lists);
+
+	// Fixed lists do not depend on the radius
+	bool uploaded = m_neighbourListRadius != -2 && (m_topology.lists || m_neighbourListRadius == m_inhibitionRadius);
+	if (!lists || uploaded)
+		return;
+
+	std::vector<int> offsets, neighbours;
+	m_topology.neighbourLists(m_inhibitionRadius, offsets, neighbours);
+	std::copy(offsets.begin(), offsets.end(), m_neighbourOffsetData.begin());
+	m_neighbourOffsetData.enqueueWrite(true);
+	if (m_neighbourData.size() != std::max<std::size_t>(neighbours.size(), 1))
+		m_neighbourData.resize(std::max<std::size_t>(neighbours.size(), 1));
+	if (!neighbours.empty())
+	{
+		std::copy(neighbours.begin(), neighbours.end(), m_neighbourData.begin());
+		m_neighbourData.enqueueWrite(true);
+	}
+	m_neighbourListRadius = m_inhibitionRadius;
+}
+
+void CLSpatialPooler::bindKernels()
+{
+	m_computeOverlapKernel.bind(m_columnData.buffer(), m_synapseData.buffer(), m_inputData.buffer());
+
+	m_inhibitNeighboursKernel.bind(m_columnData.buffer(), m_synapseData.buffer());
+	m_inhibitNeighboursKernel.setLocalArg(2, m_inhibitionTileSize * sizeof(cl_float));
+	m_inhibitNeighboursKernel.setArg(3, m_inhibitionRadius);
+
+	m_maxDutyCycleRowsKernel.bind(m_columnData.buffer(), m_rowMaxData.buffer());
+	m_maxDutyCycleRowsKernel.setLocalArg(2, m_rowSegmentSize * sizeof(cl_float));
+	m_maxDutyCycleRowsKernel.setArg(3, m_inhibitionRadius);
+	m_computeMinDutyCyclesKernel.bind(m_columnData.buffer(), m_rowMaxData.buffer());
+	m_computeMinDutyCyclesKernel.setLocalArg(2, m_columnSegmentSize * sizeof(cl_float));
+	m_computeMinDutyCyclesKernel.setArg(3, m_inhibitionRadius);
+	m_inhibitNeighbourListKernel.bind(m_columnData.buffer(), m_neighbourOffsetData.buffer(), m_neighbourData.buffer());
+	m_computeMinDutyCycleListKernel.bind(m_columnData.buffer(), m_neighbourOffsetData.buffer(), m_neighbourData.buffer());
+
+	m_updateDutyCyclesKernel.bind(m_columnData.buffer());
+	m_updatePermanencesKernel.bind(m_columnData.buffer(), m_synapseData.buffer(), m_dirtyData.buffer(), m_inputData.buffer());
+	m_refineRegionKernel.bind(m_columnData.buffer(), m_synapseData.buffer(), m_dirtyData.buffer(), m_resetCountData.buffer(), m_receptiveFieldOffsetData.buffer(), m_receptiveFieldData.buffer(), m_refineOffset, m_randomKey, m_step);
+	m_measureReceptiveFieldsKernel.bind(m_columnData.buffer(), m_synapseData.buffer(), m_spanData.buffer());
+}
+void CLSpatialPooler::snapshotSources(std::vector<CLSnapshotSource>& sources, int firstId)
+{
+	CLHostState state = {m_step, m_refineOffset, m_inhibitionRadius};
+	sources.push_back(CLSnapshotSource::full(firstId + SNAPSHOT_COLUMNS, "spatial.columns", m_columnData));
+	sources.push_back(CLSnapshotSource::blocks(firstId + SNAPSHOT_SYNAPSES, "spatial.synapses", m_synapseData, m_args.SnapshotBlockSize * m_args.ColumnProximalSynapseCount, m_dirtyData));
+	sources.push_back(CLSnapshotSource::host(firstId + SNAPSHOT_HOST_STATE, "spatial.host", state));
+}
+
+void CLSpatialPooler::restore(const CLSnapshotImage& image, int firstId)
+{
+	CLHostState state;
+	image.restore(firstId + SNAPSHOT_HOST_STATE, state);
+	image.restore(firstId + SNAPSHOT_COLUMNS, m_columnData);
+	image.restore(firstId + SNAPSHOT_SYNAPSES, m_synapseData);
+
+	m_step = state.step;
+	m_refineOffset = state.refineOffset;
+	m_inhibitionRadius = state.inhibitionRadius;
+	updateNeighbourLists();
+	bindKernels();
+}
+
 void CLSpatialPooler::getStats(CLStats& stats)
 {
+	stats.inhibitionRadius = m_inhibitionRadius;
 	m_columnData.enqueueRead(true);
 
 	stats.averageBoost = 0;
@@ -112,25 +371,33 @@ void CLSpatialPooler::getStats(CLStats& stats)
 }
 void CLSpatialPooler::backwards(const std::vector< cl_char >& columnActivation, std::vector< double >& result)
 {
-	// Make sure we're using the latest model by pulling it from the gpu..
-	m_synapseData.enqueueRead(true);
-
-	result.assign(m_topology.getInputSize(), 0);
+	std::size_t columns = m_topology.getColumns();
+	std::size_t inputSize = m_topology.getInputSize();
+	if (columnActivation.empty() || columnActivation.size() % columns != 0)
+	{
+		throw std::runtime_error("Invalid vector length!");
+	}
+	std::size_t batchSize = columnActivation.size() / columns;
 
-	for (int i = 0 ; i < m_topology.getColumns(); ++i)
+	if (m_backwardsInput.size() < columnActivation.size())
 	{
-		if (columnActivation[i])
-		{
-			int index = m_args.ColumnProximalSynapseCount * i;
-			for (int a = 0; a < m_args.ColumnProximalSynapseCount; ++a)
-			{
-				CLSynapse& syn = m_synapseData[index+a];
-				if (syn.permanence >= m_args.ConnectedPermanence)
-				{
-					result[syn.target] += 1;
-				}
-			}
-		}
+		m_backwardsInput.resize(columnActivation.size());
+		m_backwardsResult.resize(batchSize * inputSize);
 	}
-}
 
+	// The synapses never leave the device, only the activations go up and the histograms come back
+	std::copy(columnActivation.begin(), columnActivation.end(), m_backwardsInput.begin());
+	m_backwardsInput.enqueueWrite(false, 0, columnActivation.size());
+
+	// Buffers grow with the batch size, so they are bound per call
+	m_clearBackwardsKernel.setRange(m_context.device(), batchSize * inputSize);
+	m_clearBackwardsKernel.bind(m_backwardsResult.buffer());
+	m_clearBackwardsKernel.launch(m_context);
+
+	m_backwardsKernel.setRange(cl::NDRange(columns, batchSize));
+	m_backwardsKernel.bind(m_synapseData.buffer(), m_backwardsInput.buffer(), m_backwardsResult.buffer());
+	m_backwardsKernel.launch(m_context);
+
+	m_backwardsResult.enqueueRead(true, 0, batchSize * inputSize);
+	result.assign(m_backwardsResult.begin(), m_backwardsResult.begin() + batchSize * inputSize);
+}
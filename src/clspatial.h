@@ -6,6 +6,10 @@
 #include "clbuffer.h"
 #include "cltopology.h"
 #include "clargs.h"
+#include "clsnapshot.h"
+#include "clpoolsizeplanner.h"
+#include "clkernel.h"
+#include "clencoder.h"
 
 std::string getCLError(cl_int err);
 
@@ -27,6 +31,8 @@ private:
 		cl_float activeDutyCycle;
 		cl_float minDutyCycle;
 		cl_float overlapDutyCycle;
+		cl_float weakestPermanence;
+		cl_int weakestSynapse;
 	};
 
 	CLContext& m_context;
@@ -34,23 +40,113 @@ private:
 	const CLTopology m_topology;
 	const CLArgs m_args;
 
-	cl::KernelFunctor m_computeOverlapKernel;
-	cl::KernelFunctor m_inhibitNeighboursKernel;
-	cl::KernelFunctor m_updatePermanencesKernel;
-	cl::KernelFunctor m_refineRegionKernel;
+	CLKernel m_computeOverlapKernel;
+	CLKernel m_inhibitNeighboursKernel;
+	CLKernel m_maxDutyCycleRowsKernel;
+	CLKernel m_computeMinDutyCyclesKernel;
+	CLKernel m_inhibitNeighbourListKernel;
+	CLKernel m_computeMinDutyCycleListKernel;
+	CLKernel m_updateDutyCyclesKernel;
+	CLKernel m_updatePermanencesKernel;
+	CLKernel m_refineRegionKernel;
+	CLKernel m_measureReceptiveFieldsKernel;
+	CLKernel m_backwardsKernel; // launched over (columns, batch size)
+	CLKernel m_clearBackwardsKernel;
+
+	// Per step launches, computeOverlap to refineRegion. Inhibition runs either over the grid or over the
+	// neighbour lists, the other branch is switched off.
+	CLStepGraph m_stepGraph;
+	std::vector<int> m_gridInhibitionNodes;
+	std::vector<int> m_listInhibitionNodes;
+	int m_refineNode;
+	int m_updatePermanencesNode;
+
+	// Arguments of refineRegion that change between launches
+	enum
+	{
+		REFINE_FIRST_COLUMN_ARG = 6,
+		REFINE_STEP_ARG = 8
+	};
 
 	CLBuffer<CLColumn> m_columnData;
 	CLBuffer<CLSynapse> m_synapseData;
 	CLBuffer<cl_char> m_inputData;
+	CLBuffer<cl_int> m_spanData; // see measureReceptiveFields
+	CLBuffer<cl_float> m_rowMaxData; // row pass of the neighbourhood max duty cycle
+	CLBuffer<cl_char> m_backwardsInput; // grows to the largest batch seen
+	CLBuffer<cl_int> m_backwardsResult;
+	CLBuffer<cl_uint> m_dirtyData; // synapse blocks changed since the last snapshot, see CLArgs::SnapshotBlockSize
+	CLBuffer<cl_int> m_neighbourOffsetData; // see CLTopologyLists
+	CLBuffer<cl_int> m_neighbourData;
+	CLBuffer<cl_int> m_receptiveFieldOffsetData;
+	CLBuffer<cl_int> m_receptiveFieldData;
+	CLBuffer<cl_uint> m_resetCountData; // synapses reset by refineRegion, wraps around
+
+	cl_uint m_resetCount; // value of m_resetCountData last added to the metrics
+
+	int m_refineOffset; // first column of the next refineRegion slice
+	int m_refineSliceSize;
+	std::size_t m_inhibitionTileSize; // columns per inhibition work-group
+	std::size_t m_rowSegmentSize; // columns per work-group of the max duty cycle passes
+	std::size_t m_columnSegmentSize;
+	int m_inhibitionRadius; // neighbourhood width passed to inhibitNeighbours, -1 for global inhibition
+	int m_neighbourListRadius; // inhibition radius the uploaded neighbour lists were made for
+
+	// Derive the inhibition radius from the spans measured by measureReceptiveFields
+	void updateInhibitionRadius();
+	// Run a step on the input already on the device
+	void step(const std::vector<cl::Event>* waitFor, cl_char* activeColumns);
+	std::vector<cl::Event> m_encodeEvents; // kept to reuse its storage
+	// Choose grid or list inhibition for the inhibition radius and upload the neighbour lists it needs
+	void updateNeighbourLists();
+	// Bind the arguments of the kernels to the buffers and the current state
+	void bindKernels();
+
+	// Random numbers drawn by kernels are keyed on (m_randomKey, m_step)
+	cl_uint2 m_randomKey;
+	cl_uint m_step;
 
-	int m_refineCounter;
+	// Host side state that snapshots capture
+	struct CLHostState
+	{
+		cl_uint step;
+		cl_int refineOffset;
+		cl_int inhibitionRadius;
+	};
+	// Snapshot sources, relative to the first id given by the region
+	enum
+	{
+		SNAPSHOT_COLUMNS = 0,
+		SNAPSHOT_SYNAPSES,
+		SNAPSHOT_HOST_STATE
+	};
 
 public:
 
 	CLSpatialPooler(CLContext& context, const CLTopology& topo, const CLArgs& args);
+
+	// The step graph points at the kernels of the pooler, so it stays where it was constructed
+	CLSpatialPooler(const CLSpatialPooler&) = delete;
+	CLSpatialPooler& operator=(const CLSpatialPooler&) = delete;
+
+	// Device buffers the pooler allocates. Must match the allocations of the constructor.
+	static void addBuffers(const CLTopology& topo, const CLArgs& args, CLPoolSizePlanner& planner);
 	std::vector<cl_char> write(const std::vector< cl_char >& bits);
+	// Input of getInputSize() bits, activeColumns receives getColumns() activations. Does not allocate.
+	void write(const cl_char* bits, cl_char* activeColumns);
+	// Encode a record straight into the input buffer, the encoder must produce the input size
+	void write(CLEncoder& encoder, const double* values, cl_char* activeColumns);
+	int inputSize() const { return m_topology.getInputSize(); }
+	// columnActivation may hold several activations back to back, result then holds one input-sized reconstruction for each
 	void backwards(const std::vector<cl_char>& columnActivation, std::vector<double>& result);
 	void getStats(CLStats& stats);
+
+	// Buffers and host state for snapshots, with ids from firstId on
+	void snapshotSources(std::vector<CLSnapshotSource>& sources, int firstId);
+	void restore(const CLSnapshotImage& image, int firstId);
+
+	// Observe the launches of every step, see CLStepGraph::Observer
+	void setStepObserver(const CLStepGraph::Observer& observer) { m_stepGraph.setObserver(observer); }
 };
 
 
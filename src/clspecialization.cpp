@@ -0,0 +1,26 @@
+#include "clspecialization.h"
+
+#include <algorithm>
+#include <sstream>
+
+CLSpecialization::CLSpecialization(const cl::Device& device, const CLArgs& args)
+	: proximalVectorWidth(1)
+	, proximalUnroll(1)
+{
+	// Widest supported width within the device preference, synapses are loaded as pairs of floats and
+	// float16 is the widest vector load
+	int preferred = std::min<int>(device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT>(), 8);
+	while (proximalVectorWidth * 2 <= preferred && proximalVectorWidth * 2 <= args.ColumnProximalSynapseCount)
+		proximalVectorWidth *= 2;
+
+	// Short loops unroll completely, longer ones by a factor that keeps the kernels small
+	proximalUnroll = args.ColumnProximalSynapseCount <= 16 ? std::max(args.ColumnProximalSynapseCount, 1) : 4;
+}
+
+std::string CLSpecialization::buildOptions() const
+{
+	std::stringstream options; options
+	<< " -D PROXIMAL_VECTOR_WIDTH=" << proximalVectorWidth
+	<< " -D PROXIMAL_UNROLL="       << proximalUnroll;
+	return options.str();
+}
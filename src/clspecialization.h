@@ -0,0 +1,24 @@
+#ifndef CLSPECIALIZATION_H_INCLUDED
+#define CLSPECIALIZATION_H_INCLUDED
+
+#include <string>
+
+#include "clcontext.h"
+#include "clargs.h"
+
+// Build options tuning the kernels to one configuration on one device. The loop shapes are fixed by the
+// configuration, so they are passed as -D macros and the compiler sees constant trip counts and widths.
+struct CLSpecialization
+{
+	// Proximal synapses handled by one vector operation (1, 2, 4 or 8), from the preferred float vector
+	// width of the device and never wider than a column's synapses
+	int proximalVectorWidth;
+	// Unroll factor of the scalar proximal synapse loops
+	int proximalUnroll;
+
+	CLSpecialization(const cl::Device& device, const CLArgs& args);
+
+	std::string buildOptions() const;
+};
+
+#endif
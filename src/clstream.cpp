@@ -0,0 +1,119 @@
+#include <chrono>
+#include <stdexcept>
+
+#include "clstream.h"
+
+CLStream::CLStream(CLRegion& region, std::size_t capacity, std::size_t batchSize, Callback callback)
+	: m_region(region)
+	, m_queue(capacity)
+	, m_batchSize(batchSize > 0 ? batchSize : 1)
+	, m_callback(callback)
+	, m_running(true)
+	, m_pushing(0)
+	, m_pushed(0)
+	, m_rejected(0)
+	, m_processed(0)
+	, m_batches(0)
+	, m_maxQueueDepth(0)
+{
+	m_worker = std::thread(&CLStream::run, this);
+}
+
+CLStream::~CLStream()
+{
+	stop();
+}
+
+bool CLStream::push(std::uint64_t tag, const std::vector<cl_char>& sdr)
+{
+	// Checked here rather than on the worker, where a bad input could only be dropped
+	if (sdr.size() != std::size_t(m_region.inputSize()))
+		throw std::runtime_error("Invalid input length!");
+
+	m_pushing++;
+	if (!m_running)
+	{
+		m_pushing--;
+		return false;
+	}
+
+	// Slots keep the buffers of earlier inputs, so copying in does not allocate once the queue has warmed up
+	bool pushed = m_queue.tryPushWith([&](Input& slot)
+	{
+		slot.tag = tag;
+		slot.sdr.assign(sdr.begin(), sdr.end());
+	});
+	m_pushing--;
+	if (!pushed)
+	{
+		m_rejected++;
+		return false;
+	}
+	m_pushed++;
+	return true;
+}
+
+void CLStream::stop()
+{
+	m_running = false;
+	if (m_worker.joinable())
+		m_worker.join();
+}
+
+void CLStream::run()
+{
+	std::vector<Input> batch(m_batchSize);
+	std::vector<cl_char> output;
+	int idleRounds = 0;
+
+	for (;;)
+	{
+		// Check before draining, so that everything pushed before stop() is still processed
+		bool running = m_running;
+
+		std::size_t depth = m_queue.size();
+		if (depth > m_maxQueueDepth)
+			m_maxQueueDepth = depth;
+
+		std::size_t count = 0;
+		while (count < m_batchSize && m_queue.tryPop(batch[count]))
+			count++;
+
+		if (count == 0)
+		{
+			// A producer that got past the check in push() before stop() may still be queueing its input
+			if (!running && m_pushing == 0 && m_queue.size() == 0)
+				break;
+
+			// Spin briefly for low latency on steady streams, then back off to spare the host
+			if (++idleRounds < 64)
+				std::this_thread::yield();
+			else
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			continue;
+		}
+		idleRounds = 0;
+		m_batches++;
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			float anomalyScore = 0;
+			m_region.write(batch[i].sdr, output, true, &anomalyScore);
+			m_processed++;
+			if (m_callback)
+				m_callback(batch[i].tag, output, anomalyScore);
+		}
+	}
+}
+
+CLStreamStats CLStream::getStats() const
+{
+	CLStreamStats stats;
+	stats.pushed = m_pushed;
+	stats.rejected = m_rejected;
+	stats.processed = m_processed;
+	stats.batches = m_batches;
+	stats.queueDepth = m_queue.size();
+	stats.maxQueueDepth = m_maxQueueDepth;
+	return stats;
+}
@@ -0,0 +1,76 @@
+#ifndef CLSTREAM_H_INCLUDED
+#define CLSTREAM_H_INCLUDED
+
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <vector>
+#include <cstdint>
+
+#include "clregion.h"
+#include "clringbuffer.h"
+
+struct CLStreamStats
+{
+	std::uint64_t pushed; // inputs accepted
+	std::uint64_t rejected; // inputs turned away because the queue was full
+	std::uint64_t processed; // inputs written to the region
+	std::uint64_t batches; // micro-batches drained by the worker
+	std::size_t queueDepth; // inputs waiting right now
+	std::size_t maxQueueDepth; // deepest queue the worker has found
+};
+
+// Feeds a region from a lock-free queue of encoded inputs. Producers push from any thread without blocking,
+// and a worker thread drains the queue in micro-batches, steps the region once per input and reports
+// each result through a callback. A full queue rejects inputs instead of stalling producers.
+// Device work is not pipelined: each step is one blocking CLRegion::write(), since the temporal pooler
+// needs the columns the spatial pooler read back. Batching only saves the queue overhead per input.
+class CLStream
+{
+public:
+	struct Input
+	{
+		std::uint64_t tag; // passed back to the callback
+		std::vector<cl_char> sdr;
+	};
+
+	// Runs on the worker thread. output is only valid during the call.
+	typedef std::function<void(std::uint64_t tag, const std::vector<cl_char>& output, float anomalyScore)> Callback;
+
+private:
+	CLRegion& m_region;
+	CLRingBuffer<Input> m_queue;
+	std::size_t m_batchSize;
+	Callback m_callback;
+
+	std::atomic<bool> m_running;
+	std::atomic<int> m_pushing; // producers inside push(), the worker waits for them before it exits
+	std::atomic<std::uint64_t> m_pushed;
+	std::atomic<std::uint64_t> m_rejected;
+	std::atomic<std::uint64_t> m_processed;
+	std::atomic<std::uint64_t> m_batches;
+	std::atomic<std::size_t> m_maxQueueDepth;
+
+	std::thread m_worker;
+
+	void run();
+
+public:
+
+	// The region must not be used elsewhere while the stream is running
+	CLStream(CLRegion& region, std::size_t capacity, std::size_t batchSize, Callback callback);
+	~CLStream();
+
+	CLStream(const CLStream&) = delete;
+
+	// Queue an input, returns false if the queue is full or the stream was stopped.
+	// Throws if sdr does not hold as many bits as the input of the region.
+	bool push(std::uint64_t tag, const std::vector<cl_char>& sdr);
+
+	// Process what is still queued and stop the worker
+	void stop();
+
+	CLStreamStats getStats() const;
+};
+
+#endif
@@ -7,7 +7,15 @@
 #include <sstream>
 
 #include "clregion.h"
+#include "clrandom.h"
+#include "clspecialization.h"
 
+constexpr static const char* RANDOM_STREAMS_SRC =
+#include "randomstreams.cl.h"
+;
+constexpr static const char* RANDOM_SRC =
+#include "random.cl.h"
+;
 constexpr static const char* TEMPORAL_SRC =
 #include "temporal.cl.h"
 ;
@@ -16,53 +24,133 @@ CLTemporalPooler::CLTemporalPooler(CLContext& context, const CLTopology& topo, c
 	: m_context(context)
 	, m_topology(topo)
 	, m_args(args)
+	, m_poolSize(initialPoolSize(topo, args))
+	, m_maxPoolSize(maxPoolSize(topo, args))
+	, m_cellStateWords((m_topology.getColumns() * args.ColumnCellCount + 31) / 32)
 	, m_cellData(context, m_topology.getColumns() * args.ColumnCellCount)
-	, m_segmentData(context, m_topology.getColumns() * args.ColumnCellCount * args.CellSegmentCount)
-	, m_synapseData(context, m_topology.getColumns() * args.ColumnCellCount * args.CellSegmentCount * args.SegmentSynapseCount)
+	, m_cellStateData(context, 2 * CELL_STATE_COUNT * m_cellStateWords)
+	, m_cellOutputData(context, m_topology.getColumns() * args.ColumnCellCount)
+	, m_segmentData(context, m_poolSize)
+	, m_segmentActivityData(context, m_poolSize * 2 * args.segmentActivitySize())
+	, m_synapseData(context, m_poolSize * args.SegmentSynapseCount)
+	, m_scoreData(context, m_topology.getColumns() * args.ColumnCellCount)
+	, m_cellSegmentData(context, m_topology.getColumns() * args.ColumnCellCount * args.CellSegmentCount)
+	, m_poolData(context, POOL_HEADER_SIZE + m_poolSize)
 	, m_inputData(context, m_topology.getColumns())
+	, m_anomalyData(context, ANOMALY_COUNTER_COUNT)
+	, m_dirtyData(context, dirtyWords())
+	, m_randomKey(CLRandom::makeKey(args.RandomSeed))
+	, m_step(0)
 {
 	std::cerr << "CLTemporalPooler: Initializing" << std::endl;
 
-	// Install kernel programs
-	std::string definitions = args.serialize() + topo.serialize();
-
-	cl::Program::Sources sources;
-	sources.push_back({definitions.c_str(), definitions.length()});
-	sources.push_back({TEMPORAL_SRC, strlen(TEMPORAL_SRC)});
-
-	cl::Program program(context.nativeContext(), sources);
-	try
+	// Segment and synapse indices are stored in bytes on the device
+	if (args.CellSegmentCount > 127 || args.SegmentSynapseCount > 255)
 	{
-		program.build({context.device()});
+		throw std::runtime_error("Too many segments per cell or synapses per segment!");
 	}
-	catch(const cl::Error& err)
+	if (args.SnapshotBlockSize <= 0)
 	{
-		std::cerr << "Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(context.device()) << std::endl;
-		throw;
+		throw std::runtime_error("Invalid snapshot block size!");
 	}
 
-	m_timeStepKernel = cl::KernelFunctor(cl::Kernel(program, "timeStep"), context.queue(), cl::NullRange, cl::NDRange(m_topology.getColumns()), cl::NullRange);
-	m_computeActiveStateKernel = cl::KernelFunctor(cl::Kernel(program, "computeActiveState"), context.queue(), cl::NullRange, cl::NDRange(m_topology.getColumns()), cl::NullRange);
-	m_computePredictiveState = cl::KernelFunctor(cl::Kernel(program, "computePredictiveState"), context.queue(), cl::NullRange, cl::NDRange(m_topology.getColumns()), cl::NullRange);
-	m_updateSynapsesKernel = cl::KernelFunctor(cl::Kernel(program, "updateSynapses"), context.queue(), cl::NullRange, cl::NDRange(m_topology.getColumns()), cl::NullRange);
-	
+	// Install kernel programs
+	std::string definitions = args.serialize() + topo.serialize();
+	cl::Program program = context.buildProgram({definitions, RANDOM_STREAMS_SRC, RANDOM_SRC, "\n#line 1\n", TEMPORAL_SRC}, CLSpecialization(context.device(), args).buildOptions());
+
+	cl::Device& device = context.device();
+	m_computeActiveStateKernel = CLKernel(program, "computeActiveState");
+	m_publishActiveKernel = CLKernel(program, "publishCellStates");
+	m_computePredictiveState = CLKernel(program, "computePredictiveState");
+	m_publishPredictiveKernel = CLKernel(program, "publishCellStates");
+	m_updateSynapsesKernel = CLKernel(program, "updateSynapses");
+	m_compactSegmentsKernel = CLKernel(program, "compactSegments");
+	for (CLKernel* kernel : {&m_computeActiveStateKernel, &m_computePredictiveState, &m_updateSynapsesKernel, &m_compactSegmentsKernel})
+		kernel->setRange(device, m_topology.getColumns());
+	for (CLKernel* kernel : {&m_publishActiveKernel, &m_publishPredictiveKernel})
+		kernel->setRange(device, m_cellStateWords);
+	bindKernels();
+
+	// Each phase writes the states of its own cells only and publishes them into the NOW planes for the
+	// phases after it, so no launch reads cell states that are still being written.
+	// Phase 1: Compute active state for each cell
+	m_stepGraph.add(m_computeActiveStateKernel);
+	m_stepGraph.add(m_publishActiveKernel);
+	// Phase 2: Compute predictive state for each cell
+	m_stepGraph.add(m_computePredictiveState);
+	m_stepGraph.add(m_publishPredictiveKernel);
+	// Phase 3: Update permanences
+	m_stepGraph.add(m_updateSynapsesKernel);
+
 	// Initialize region
-	cl::KernelFunctor initRegion =
-	cl::KernelFunctor(cl::Kernel(program, "initRegion"), context.queue(),
-		cl::NullRange, cl::NDRange(m_topology.getColumns()), cl::NullRange);
-
-	cl_uint2 randomState;
-	randomState.s[0] = rand();
-	randomState.s[1] = rand();
-	initRegion(m_cellData.buffer(), m_segmentData.buffer(), m_synapseData.buffer(), randomState);
+	CLKernel initRegion(program, "initRegion");
+	initRegion.setRange(device, m_topology.getColumns());
+
+	// Start with an empty pool
+	m_poolData[POOL_TOP] = 0;
+	m_poolData[POOL_FREE_COUNT] = 0;
+	m_poolData[POOL_FAILED] = 0;
+	m_poolData[POOL_CAPACITY] = m_poolSize;
+	m_poolData[POOL_SYNAPSES_RESET] = 0;
+	m_poolData[POOL_SEGMENTS_ADAPTED] = 0;
+	m_poolData.enqueueWrite(false, 0, POOL_HEADER_SIZE);
+	m_synapsesReset = 0;
+	m_segmentsAdapted = 0;
+	m_context.metrics().set(CLMetrics::SEGMENT_POOL_SIZE, m_poolSize);
+
+	m_dirtyData.enqueueWrite(false);
+	// Both time slots start empty. The host copy is still all zeros.
+	m_cellStateData.enqueueWrite(false);
+	initRegion.bind(m_cellData.buffer(), m_cellStateData.buffer(), m_segmentData.buffer(), m_segmentActivityData.buffer(), m_synapseData.buffer(), m_scoreData.buffer(), m_cellSegmentData.buffer(), m_poolData.buffer(), m_dirtyData.buffer(), m_cellOutputData.buffer(), m_step);
+	initRegion.launch(context);
 	std::cerr << "CLTemporalPooler: Kernels loaded" << std::endl;
 }
+int CLTemporalPooler::maxPoolSize(const CLTopology& topo, const CLArgs& args)
+{
+	int full = topo.getColumns() * args.ColumnCellCount * args.CellSegmentCount;
+	return args.SegmentPoolLimit > 0 ? std::min(full, args.SegmentPoolLimit) : full;
+}
+
+int CLTemporalPooler::initialPoolSize(const CLTopology& topo, const CLArgs& args)
+{
+	int initial = args.SegmentPoolSize > 0 ? args.SegmentPoolSize : topo.getColumns() * args.ColumnCellCount;
+	return std::min(initial, maxPoolSize(topo, args));
+}
+
+void CLTemporalPooler::addBuffers(const CLTopology& topo, const CLArgs& args, CLPoolSizePlanner& planner)
+{
+	std::size_t cells = topo.getColumns() * args.ColumnCellCount;
+	std::size_t blockSize = std::max(args.SnapshotBlockSize, 1);
+	std::size_t activitySize = args.segmentActivitySize();
+	std::size_t segmentSynapses = args.SegmentSynapseCount;
+
+	planner.add("Cells", cells * sizeof(CLCell));
+	planner.add("Cell states", 2 * CELL_STATE_COUNT * ((cells + 31) / 32) * sizeof(cl_uint));
+	planner.add("Cell outputs", cells * sizeof(cl_uchar));
+	planner.add("Segments", [](int poolSize) { return poolSize * sizeof(CLSegment); });
+	planner.add("Segment activity", [activitySize](int poolSize) { return poolSize * 2 * activitySize; });
+	planner.add("Distal synapses", [segmentSynapses](int poolSize) { return poolSize * segmentSynapses * sizeof(CLSynapse); });
+	planner.add("Segment scores", cells * sizeof(CLSegmentScore));
+	planner.add("Cell segments", cells * args.CellSegmentCount * sizeof(cl_int));
+	planner.add("Segment pool", [](int poolSize) { return (POOL_HEADER_SIZE + poolSize) * sizeof(cl_int); });
+	planner.add("Temporal input", topo.getColumns() * sizeof(cl_char));
+	planner.add("Anomaly counters", ANOMALY_COUNTER_COUNT * sizeof(cl_int));
+	planner.add("Distal dirty blocks", [blockSize](int poolSize) { return ((poolSize + blockSize - 1) / blockSize + 31) / 32 * sizeof(cl_uint); });
+}
+
 void CLTemporalPooler::pullBuffers(bool cells, bool segments, bool synapses)
 {
 	if (cells)
+	{
 		m_cellData.enqueueRead(false);
+		m_cellStateData.enqueueRead(false);
+		m_cellSegmentData.enqueueRead(false);
+	}
 	if (segments)
+	{
 		m_segmentData.enqueueRead(false);
+		m_segmentActivityData.enqueueRead(false);
+	}
 	if (synapses)
 		m_synapseData.enqueueRead(false);
 	m_context.queue().finish();
@@ -70,88 +158,237 @@ void CLTemporalPooler::pullBuffers(bool cells, bool segments, bool synapses)
 void CLTemporalPooler::pushBuffers(bool cells, bool segments, bool synapses)
 {
 	if (cells)
+	{
 		m_cellData.enqueueWrite(false);
+		m_cellStateData.enqueueWrite(false);
+		m_cellSegmentData.enqueueWrite(false);
+	}
 	if (segments)
+	{
 		m_segmentData.enqueueWrite(false);
+		m_segmentActivityData.enqueueWrite(false);
+	}
 	if (synapses)
 		m_synapseData.enqueueWrite(false);
 	m_context.queue().finish();
 }
 
-void CLTemporalPooler::write(const std::vector< cl_char >& activations_in, std::vector< cl_char >& results_out)
+void CLTemporalPooler::write(const std::vector< cl_char >& activations_in, std::vector< cl_char >& results_out, float* anomalyScore)
 {
 	if (activations_in.size() != std::size_t(m_topology.getColumns()))
 	{
 		throw std::runtime_error("Invalid vector length!");
 	}
 
-	// Send input column activations to device
-	m_inputData.enqueueWrite(true, activations_in);
-
-	// provide GPU some poor man's randomness
-	cl_uint2 randomSeed;
-	randomSeed.s[0] = rand();
-	randomSeed.s[1] = rand();
-
-	// Phase 0: Step forwards in time
-	m_timeStepKernel(m_cellData.buffer(), m_segmentData.buffer(), m_synapseData.buffer());
+	results_out.resize(m_topology.getColumns());
+	write(activations_in.data(), results_out.data(), anomalyScore);
+}
+void CLTemporalPooler::write(const cl_char* activations_in, cl_char* results_out, float* anomalyScore)
+{
+	// Send input column activations to device, the results are read back before returning
+	m_inputData.enqueueWrite(false, activations_in);
+	m_step++;
 
-	// Phase 1: Compute active state for each cell
-	m_computeActiveStateKernel(m_cellData.buffer(), m_segmentData.buffer(), m_synapseData.buffer(), m_inputData.buffer(), randomSeed);
+	m_anomalyData[ANOMALY_ACTIVE_COLUMNS] = 0;
+	m_anomalyData[ANOMALY_UNPREDICTED_COLUMNS] = 0;
+	m_anomalyData.enqueueWrite(false);
 
-	// Phase 2: Compute predictive state for each cell
-	m_computePredictiveState(m_cellData.buffer(), m_segmentData.buffer(), m_synapseData.buffer(), m_inputData.buffer(), randomSeed);
+	// Phases 1 to 3, see the step graph in the constructor
+	m_computeActiveStateKernel.setArg(STATE_ARG_COUNT + 2, m_step);
+	m_computePredictiveState.setArg(STATE_ARG_COUNT + 2, m_step);
+	// Steps that do not learn queue no segment updates. Changes queued by earlier steps are still settled by
+	// updateSynapses, since whether a prediction came true is only known on the step after it was queued.
+	cl_uint learn = m_args.learnsAt(m_step);
+	m_computeActiveStateKernel.setArg(STATE_ARG_COUNT + 3, learn);
+	m_computePredictiveState.setArg(STATE_ARG_COUNT + 3, learn);
+	m_publishActiveKernel.setArg(STATE_ARG_COUNT + 1, m_step);
+	m_publishPredictiveKernel.setArg(STATE_ARG_COUNT + 1, m_step);
+	m_updateSynapsesKernel.setArg(STATE_ARG_COUNT + 2, m_step);
+	m_stepGraph.run(m_context);
 
-	// Phase 3: Update permanences
-	m_updateSynapsesKernel(m_cellData.buffer(), m_segmentData.buffer(), m_synapseData.buffer(), m_inputData.buffer());
+	// Extra: Return dead segments to the pool every N iterations
+	if (m_args.SegmentCompactionInterval > 0 && m_step % m_args.SegmentCompactionInterval == 0)
+	{
+		compactSegments();
+	}
 
 	// Obtain result (list of column activity) from compute device and save to results_out
-	results_out.resize(m_topology.getColumns());
+	if (anomalyScore)
+		m_anomalyData.enqueueRead(false);
+	m_poolData.enqueueRead(false, POOL_SYNAPSES_RESET, 2);
 	m_inputData.enqueueRead(true, results_out);
+
+	recordLearning();
+	m_stepGraph.record(m_context.metrics());
+
+	if (anomalyScore)
+	{
+		int active = m_anomalyData[ANOMALY_ACTIVE_COLUMNS];
+		*anomalyScore = active > 0 ? float(m_anomalyData[ANOMALY_UNPREDICTED_COLUMNS]) / active : 0.0f;
+	}
 }
 
-void CLTemporalPooler::getStats(CLStats& stats)
+void CLTemporalPooler::recordLearning()
 {
-	pullBuffers();
+	cl_uint synapsesReset = m_poolData[POOL_SYNAPSES_RESET];
+	cl_uint segmentsAdapted = m_poolData[POOL_SEGMENTS_ADAPTED];
+	m_context.metrics().add(CLMetrics::SYNAPSES_RESET, cl_uint(synapsesReset - m_synapsesReset));
+	m_context.metrics().add(CLMetrics::SEGMENTS_ADAPTED, cl_uint(segmentsAdapted - m_segmentsAdapted));
+	m_synapsesReset = synapsesReset;
+	m_segmentsAdapted = segmentsAdapted;
+}
 
-	stats.activeState = 0;
-	stats.predictiveState = 0;
-	stats.learningState = 0;
-	for (int i = 0; i < int(m_cellData.size()); ++i)
+void CLTemporalPooler::compactSegments()
+{
+	m_compactSegmentsKernel.setArg(STATE_ARG_COUNT, m_step);
+	m_compactSegmentsKernel.launch(m_context);
+
+	// Only the pool header is needed to decide whether to grow
+	m_poolData.enqueueRead(true, 0, POOL_HEADER_SIZE);
+	// The learning counters are cleared below, count what they advanced by first
+	recordLearning();
+
+	int top = std::min(m_poolData[POOL_TOP], m_poolSize);
+	int used = top - m_poolData[POOL_FREE_COUNT];
+
+	if ((m_poolData[POOL_FAILED] > 0 || used > m_poolSize * 3 / 4) && m_poolSize < m_maxPoolSize)
 	{
-		CLCell& cell = m_cellData[i];
-		if (cell.state & 0x1)
-			stats.activeState ++;
-		if (cell.state & 0x2)
-			stats.predictiveState ++;
-		if (cell.state & 0x4)
-			stats.learningState ++;
+		resizePool(std::min(m_poolSize * 2, m_maxPoolSize));
 	}
 
-	stats.averageSegmentDutyCycle = 0;
-// 	double act = 0;
-	for (const CLSegment& seg: m_segmentData)
+	// Allocations past the end of the pool failed, rewind the top so that it can be used again
+	m_poolData[POOL_TOP] = top;
+	m_poolData[POOL_FAILED] = 0;
+	m_poolData[POOL_CAPACITY] = m_poolSize;
+	m_poolData[POOL_SYNAPSES_RESET] = 0;
+	m_poolData[POOL_SEGMENTS_ADAPTED] = 0;
+	m_poolData.enqueueWrite(false, 0, POOL_HEADER_SIZE);
+	m_synapsesReset = 0;
+	m_segmentsAdapted = 0;
+	m_context.metrics().set(CLMetrics::SEGMENT_POOL_SIZE, m_poolSize);
+}
+
+void CLTemporalPooler::resizePool(int poolSize)
+{
+	m_poolSize = poolSize;
+
+	m_segmentData.resize(m_poolSize);
+	m_segmentActivityData.resize(m_poolSize * 2 * m_args.segmentActivitySize());
+	m_synapseData.resize(m_poolSize * m_args.SegmentSynapseCount);
+	m_poolData.resize(POOL_HEADER_SIZE + m_poolSize);
+	m_context.metrics().set(CLMetrics::SEGMENT_POOL_SIZE, m_poolSize);
+
+	// Snapshots copy resized buffers in full, so tracking starts over
+	m_dirtyData.resize(dirtyWords());
+	std::fill(m_dirtyData.begin(), m_dirtyData.end(), 0);
+	m_dirtyData.enqueueWrite(false);
+	bindKernels();
+}
+
+void CLTemporalPooler::bindKernels()
+{
+	auto bindState = [&](CLKernel& kernel)
+	{
+		kernel.bind(m_cellData.buffer(), m_cellStateData.buffer(), m_segmentData.buffer(), m_segmentActivityData.buffer(), m_synapseData.buffer(), m_scoreData.buffer(), m_cellSegmentData.buffer(), m_poolData.buffer(), m_dirtyData.buffer(), m_cellOutputData.buffer());
+	};
+	for (CLKernel* kernel : {&m_computeActiveStateKernel, &m_publishActiveKernel, &m_computePredictiveState, &m_publishPredictiveKernel, &m_updateSynapsesKernel, &m_compactSegmentsKernel})
+		bindState(*kernel);
+
+	m_publishActiveKernel.setArg(STATE_ARG_COUNT, cl_uint((1 << CELL_STATE_ACTIVE) | (1 << CELL_STATE_LEARN)));
+	m_publishActiveKernel.setArg(STATE_ARG_COUNT + 1, m_step);
+	m_publishPredictiveKernel.setArg(STATE_ARG_COUNT, cl_uint(1 << CELL_STATE_PREDICTIVE));
+	m_publishPredictiveKernel.setArg(STATE_ARG_COUNT + 1, m_step);
+	for (CLKernel* kernel : {&m_computeActiveStateKernel, &m_computePredictiveState})
+	{
+		kernel->setArg(STATE_ARG_COUNT, m_inputData.buffer());
+		kernel->setArg(STATE_ARG_COUNT + 1, m_randomKey);
+		kernel->setArg(STATE_ARG_COUNT + 2, m_step);
+		kernel->setArg(STATE_ARG_COUNT + 3, cl_uint(1));
+	}
+	m_updateSynapsesKernel.setArg(STATE_ARG_COUNT, m_inputData.buffer());
+	m_updateSynapsesKernel.setArg(STATE_ARG_COUNT + 1, m_anomalyData.buffer());
+	m_updateSynapsesKernel.setArg(STATE_ARG_COUNT + 2, m_step);
+	m_compactSegmentsKernel.setArg(STATE_ARG_COUNT, m_step);
+}
+
+int CLTemporalPooler::dirtyWords() const
+{
+	int blockSize = std::max(m_args.SnapshotBlockSize, 1);
+	return ((m_poolSize + blockSize - 1) / blockSize + 31) / 32;
+}
+
+void CLTemporalPooler::snapshotSources(std::vector<CLSnapshotSource>& sources, int firstId)
+{
+	CLHostState state = {m_step, m_poolSize};
+	sources.push_back(CLSnapshotSource::full(firstId + SNAPSHOT_CELLS, "temporal.cells", m_cellData));
+	sources.push_back(CLSnapshotSource::full(firstId + SNAPSHOT_CELL_STATES, "temporal.cellStates", m_cellStateData));
+	sources.push_back(CLSnapshotSource::full(firstId + SNAPSHOT_SEGMENTS, "temporal.segments", m_segmentData));
+	sources.push_back(CLSnapshotSource::full(firstId + SNAPSHOT_SEGMENT_ACTIVITY, "temporal.segmentActivity", m_segmentActivityData));
+	sources.push_back(CLSnapshotSource::blocks(firstId + SNAPSHOT_SYNAPSES, "temporal.synapses", m_synapseData, m_args.SnapshotBlockSize * m_args.SegmentSynapseCount, m_dirtyData));
+	sources.push_back(CLSnapshotSource::full(firstId + SNAPSHOT_SCORES, "temporal.scores", m_scoreData));
+	sources.push_back(CLSnapshotSource::full(firstId + SNAPSHOT_CELL_SEGMENTS, "temporal.cellSegments", m_cellSegmentData));
+	sources.push_back(CLSnapshotSource::full(firstId + SNAPSHOT_POOL, "temporal.pool", m_poolData));
+	sources.push_back(CLSnapshotSource::host(firstId + SNAPSHOT_HOST_STATE, "temporal.host", state));
+}
+
+void CLTemporalPooler::restore(const CLSnapshotImage& image, int firstId)
+{
+	CLHostState state;
+	image.restore(firstId + SNAPSHOT_HOST_STATE, state);
+	if (state.poolSize <= 0 || state.poolSize > m_maxPoolSize)
 	{
-		stats.averageSegmentDutyCycle += seg.activeDutyCycle;
+		throw std::runtime_error("Snapshot does not match the region configuration!");
+	}
+	if (state.poolSize != m_poolSize)
+		resizePool(state.poolSize);
+
+	image.restore(firstId + SNAPSHOT_CELLS, m_cellData);
+	image.restore(firstId + SNAPSHOT_CELL_STATES, m_cellStateData);
+	image.restore(firstId + SNAPSHOT_SEGMENTS, m_segmentData);
+	image.restore(firstId + SNAPSHOT_SEGMENT_ACTIVITY, m_segmentActivityData);
+	image.restore(firstId + SNAPSHOT_SYNAPSES, m_synapseData);
+	image.restore(firstId + SNAPSHOT_SCORES, m_scoreData);
+	image.restore(firstId + SNAPSHOT_CELL_SEGMENTS, m_cellSegmentData);
+	image.restore(firstId + SNAPSHOT_POOL, m_poolData);
+	m_step = state.step;
+	// Learning of the restored state was counted when it happened
+	m_synapsesReset = m_poolData[POOL_SYNAPSES_RESET];
+	m_segmentsAdapted = m_poolData[POOL_SEGMENTS_ADAPTED];
+	bindKernels();
+}
+
+int CLTemporalPooler::cellStatePlaneOffset(CellState plane) const
+{
+	// Planes of the step written last
+	return ((m_step & 1) * CELL_STATE_COUNT + plane) * m_cellStateWords;
+}
+
+void CLTemporalPooler::getStats(CLStats& stats)
+{
+	pullBuffers();
 
-// 		if (seg.activity[0][0] > act)
-// 			act = seg.activity[0][0];
+	// Count set bits in the planes of the current timestep
+	int counts[CELL_STATE_COUNT] = {};
+	for (int plane = 0; plane < CELL_STATE_COUNT; ++plane)
+	{
+		int offset = cellStatePlaneOffset(CellState(plane));
+		for (int i = 0; i < m_cellStateWords; ++i)
+		{
+			for (cl_uint bits = m_cellStateData[offset + i]; bits; bits &= bits - 1)
+				counts[plane]++;
+		}
 	}
-	stats.averageSegmentDutyCycle /= m_segmentData.size();
-// 	std::cout << "max segment activity: " << act << std::endl;
-
-// 	double synsum = 0;
-// 	for (const CLSynapse& syn: m_synapseData)
-// 	{
-// 		synsum += syn.permanence;
-// 	}
-// 	std::cout << (synsum / m_synapseData.size()) << std::endl;
-
-	/*stats.maxSegments = m_topology.getColumns() * m_args.ColumnCellCount * m_args.CellMaxSegments;
-	stats.maxSynapses = m_topology.getColumns() * m_args.ColumnCellCount * m_args.CellMaxSegments * m_args.SegmentMaxSynapses;
+	stats.activeState = counts[CELL_STATE_ACTIVE];
+	stats.predictiveState = counts[CELL_STATE_PREDICTIVE];
+	stats.learningState = counts[CELL_STATE_LEARN];
+
+	stats.maxSegments = m_maxPoolSize;
+	stats.maxSynapses = m_maxPoolSize * m_args.SegmentSynapseCount;
 	stats.totalSegments = 0;
 	stats.totalSynapses = 0;
+	stats.averageSegmentDutyCycle = 0;
 
+	// Only segments referenced by cells are alive, the rest of the pool is free
 	for (int i = 0; i < int(m_cellData.size()); ++i)
 	{
 		CLCell& cell = m_cellData[i];
@@ -159,9 +396,12 @@ void CLTemporalPooler::getStats(CLStats& stats)
 
 		for (int a = 0; a < cell.segmentCount; ++a)
 		{
-			int offset = i * m_args.CellMaxSegments;
-			CLSegment& seg = m_segmentData[offset+a];
+			int offset = i * m_args.CellSegmentCount;
+			CLSegment& seg = m_segmentData[m_cellSegmentData[offset+a]];
 			stats.totalSynapses += seg.synapseCount;
+			stats.averageSegmentDutyCycle += seg.activeDutyCycle;
 		}
-	}*/
+	}
+	if (stats.totalSegments > 0)
+		stats.averageSegmentDutyCycle /= stats.totalSegments;
 }
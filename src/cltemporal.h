@@ -6,6 +6,9 @@
 #include "clbuffer.h"
 #include "cltopology.h"
 #include "clargs.h"
+#include "clsnapshot.h"
+#include "clpoolsizeplanner.h"
+#include "clkernel.h"
 
 std::string getCLError(cl_int err);
 
@@ -18,42 +21,45 @@ private:
 	{
 		cl_float permanence;
 		cl_float permanenceQueued;
-		cl_int targetColumn;
-		cl_uchar targetCell;
-		cl_uchar targetCellState;
-
-		// Bits in Cellstate:
-		// 0 = active
-		// 1 = predictive
-		// 2 = learning
-		// 3
-		// 4 = was active
-		// 5 = was predictive
-		// 6 = was learning
-		// 7 =
+		cl_int targetCell; // column * ColumnCellCount + cell
 	};
 	struct CLSegment
 	{
-		// Activity of the segment
-		// 0 = activeState, 1 = learnState
-		// 0 = now, 1 = previous timestep
-		cl_uchar activity[2][2];
-
-		// Activity that includes synapses with permanence below CONNECTED_PERMANENCE but above MIN_PERMANENCE
-		// 0 = activeState, 1 = learnState
-		// 0 = now, 1 = previous timestep
-		cl_uchar fullActivity[2][2];
-
-		cl_bool sequenceSegment;
-		cl_bool sequenceSegmentQueued;
-		cl_bool hasQueuedChanges;
-
+		cl_uchar synapseCount;
+		cl_uchar flags; // sequence segment, queued sequence segment, has queued changes
 		cl_float activeDutyCycle; // how often this segment is active when the cell is active
 	};
 	struct CLCell
 	{
-		// See state definitions above
-		cl_uchar state;
+		cl_uchar segmentCount;
+	};
+	struct CLSegmentScore
+	{
+		// Per-cell segment search results, cached by the kernels
+		// Indexed by step parity like the cell state planes
+		cl_char activeSegment[2];
+		cl_char matchingSegment[2];
+		cl_uchar matchingActivity[2];
+	};
+
+	// Must match AnomalyCounter in temporal.cl
+	enum
+	{
+		ANOMALY_ACTIVE_COLUMNS = 0,
+		ANOMALY_UNPREDICTED_COLUMNS,
+		ANOMALY_COUNTER_COUNT
+	};
+
+	// Header of m_poolData, followed by the stack of released segments. Must match PoolHeader in temporal.cl.
+	enum
+	{
+		POOL_TOP = 0,
+		POOL_FREE_COUNT,
+		POOL_FAILED,
+		POOL_CAPACITY,
+		POOL_SYNAPSES_RESET,
+		POOL_SEGMENTS_ADAPTED,
+		POOL_HEADER_SIZE
 	};
 
 	CLContext& m_context;
@@ -61,24 +67,119 @@ private:
 	const CLTopology m_topology;
 	const CLArgs m_args;
 
-	cl::KernelFunctor m_timeStepKernel;
-	cl::KernelFunctor m_computeActiveStateKernel;
-	cl::KernelFunctor m_computePredictiveState;
-	cl::KernelFunctor m_updateSynapsesKernel;
+	CLKernel m_computeActiveStateKernel;
+	CLKernel m_publishActiveKernel; // publishCellStates for the active and learn planes
+	CLKernel m_publishPredictiveKernel;
+	CLKernel m_computePredictiveState;
+	CLKernel m_updateSynapsesKernel;
+	CLKernel m_compactSegmentsKernel;
+	CLStepGraph m_stepGraph; // computeActiveState to updateSynapses
+
+	// Every kernel takes the buffers of the State struct in temporal.cl first, the arguments after them differ
+	enum
+	{
+		STATE_ARG_COUNT = 10
+	};
+
+	// Segments and their synapses live in pools that grow up to m_maxPoolSize segments
+	int m_poolSize;
+	int m_maxPoolSize;
+
+	int m_cellStateWords;
 
 	CLBuffer<CLCell> m_cellData;
+	CLBuffer<cl_uint> m_cellStateData;
+	CLBuffer<cl_uchar> m_cellOutputData; // cell states of the current phase before publishCellStates packs them
 	CLBuffer<CLSegment> m_segmentData;
+	CLBuffer<cl_uchar> m_segmentActivityData; // packed counters, see CLArgs::segmentActivitySize()
 	CLBuffer<CLSynapse> m_synapseData;
+	CLBuffer<CLSegmentScore> m_scoreData;
+	CLBuffer<cl_int> m_cellSegmentData;
+	CLBuffer<cl_int> m_poolData;
 	CLBuffer<cl_char> m_inputData;
+	CLBuffer<cl_int> m_anomalyData;
+	CLBuffer<cl_uint> m_dirtyData; // synapse blocks changed since the last snapshot, see CLArgs::SnapshotBlockSize
+
+	// Random numbers drawn by kernels are keyed on (m_randomKey, m_step)
+	cl_uint2 m_randomKey;
+	cl_uint m_step;
+
+	// Learning counters of the pool header as last added to the metrics, they wrap around on the device
+	cl_uint m_synapsesReset;
+	cl_uint m_segmentsAdapted;
 
 	void pushBuffers(bool cells = true, bool segments = true, bool synapses = true);
 	void pullBuffers(bool cells = true, bool segments = true, bool synapses = true);
 
+	// Release dead segments and grow the pool if it is running out
+	void compactSegments();
+	// Bind the arguments of the kernels to the buffers and the current state
+	void bindKernels();
+	// Reallocate the pooled buffers for poolSize segments
+	void resizePool(int poolSize);
+	int dirtyWords() const;
+	// Add what the learning counters of the pool header advanced by since the last call to the metrics
+	void recordLearning();
+
+	// Host side state that snapshots capture
+	struct CLHostState
+	{
+		cl_uint step;
+		cl_int poolSize;
+	};
+	// Snapshot sources, relative to the first id given by the region
+	enum
+	{
+		SNAPSHOT_CELLS = 0,
+		SNAPSHOT_CELL_STATES,
+		SNAPSHOT_SEGMENTS,
+		SNAPSHOT_SEGMENT_ACTIVITY,
+		SNAPSHOT_SYNAPSES,
+		SNAPSHOT_SCORES,
+		SNAPSHOT_CELL_SEGMENTS,
+		SNAPSHOT_POOL,
+		SNAPSHOT_HOST_STATE
+	};
+
 public:
 
+	// Bitplanes of m_cellStateData, two timestep slots of CELL_STATE_COUNT planes each. Must match CellState in temporal.cl.
+	enum CellState
+	{
+		CELL_STATE_ACTIVE = 0,
+		CELL_STATE_PREDICTIVE,
+		CELL_STATE_LEARN,
+		CELL_STATE_COUNT
+	};
+
 	CLTemporalPooler(CLContext& context, const CLTopology& topo, const CLArgs& args);
-	void write(const std::vector< cl_char >& activations_in, std::vector< cl_char >& results_out);
+
+	// The step graph points at the kernels of the pooler, so it stays where it was constructed
+	CLTemporalPooler(const CLTemporalPooler&) = delete;
+	CLTemporalPooler& operator=(const CLTemporalPooler&) = delete;
+
+	// Device buffers the pooler allocates, sized by pool size. Must match the allocations of the constructor.
+	static void addBuffers(const CLTopology& topo, const CLArgs& args, CLPoolSizePlanner& planner);
+	// Segments the pool may grow to
+	static int maxPoolSize(const CLTopology& topo, const CLArgs& args);
+	// Segments the pool starts with
+	static int initialPoolSize(const CLTopology& topo, const CLArgs& args);
+	// If anomalyScore is given, it receives the fraction of active columns that were not predicted on the previous step
+	void write(const std::vector< cl_char >& activations_in, std::vector< cl_char >& results_out, float* anomalyScore = nullptr);
+	// Both take getColumns() activations. Does not allocate.
+	void write(const cl_char* activations_in, cl_char* results_out, float* anomalyScore = nullptr);
 	void getStats(CLStats& stats);
+
+	// Buffers and host state for snapshots, with ids from firstId on
+	void snapshotSources(std::vector<CLSnapshotSource>& sources, int firstId);
+	void restore(const CLSnapshotImage& image, int firstId);
+
+	// Observe the launches of every step, see CLStepGraph::Observer
+	void setStepObserver(const CLStepGraph::Observer& observer) { m_stepGraph.setObserver(observer); }
+
+	// Cell states stay on the device for other kernels to read: one bit per cell, plane words start at cellStatePlaneOffset()
+	cl::Buffer& cellStateBuffer() { return m_cellStateData.buffer(); }
+	int cellStatePlaneOffset(CellState plane) const;
 };
 
 #endif
@@ -1,14 +1,126 @@
 #include <sstream>
+#include <stdexcept>
+#include <algorithm>
 #include "cltopology.h"
 
+namespace
+{
+	// Coordinates along an axis of the given size that lie within half of center
+	void axisWindow(int center, int size, int half, bool wrap, std::vector<int>& window)
+	{
+		window.clear();
+		if (wrap && 2 * half + 1 < size)
+		{
+			for (int d = -half; d <= half; ++d)
+				window.push_back((center + d + size) % size);
+		}
+		else
+		{
+			int from = wrap ? 0 : std::max(center - half, 0);
+			int to = wrap ? size : std::min(center + half + 1, size);
+			for (int i = from; i < to; ++i)
+				window.push_back(i);
+		}
+	}
+
+	bool validLists(const std::vector<int>& offsets, const std::vector<int>& entries, int rows, int range, bool allowEmpty)
+	{
+		if (offsets.size() != std::size_t(rows) + 1 || offsets.front() != 0 || offsets.back() != int(entries.size()))
+			return false;
+		for (int i = 0; i < rows; ++i)
+		{
+			if (offsets[i + 1] < offsets[i] || (!allowEmpty && offsets[i + 1] == offsets[i]))
+				return false;
+		}
+		return std::all_of(entries.begin(), entries.end(), [range](int entry) { return entry >= 0 && entry < range; });
+	}
+}
+
+void CLTopology::neighbourLists(int radius, std::vector<int>& offsets, std::vector<int>& neighbours) const
+{
+	if (lists)
+	{
+		offsets = lists->neighbourOffsets;
+		neighbours = lists->neighbours;
+		return;
+	}
+
+	// Same neighbourhood as the tiled kernels, a box of width radius around the column
+	int half = radius < 0 ? std::max(regionWidth, std::max(regionHeight, regionDepth)) : radius / 2;
+	offsets.assign(1, 0);
+	neighbours.clear();
+	neighbours.reserve(neighbourListSize(radius));
+
+	std::vector<int> windowX, windowY, windowZ;
+	for (int z = 0; z < regionDepth; ++z)
+	{
+		axisWindow(z, regionDepth, half, wrap, windowZ);
+		for (int y = 0; y < regionHeight; ++y)
+		{
+			axisWindow(y, regionHeight, half, wrap, windowY);
+			for (int x = 0; x < regionWidth; ++x)
+			{
+				axisWindow(x, regionWidth, half, wrap, windowX);
+				for (int nz : windowZ)
+					for (int ny : windowY)
+						for (int nx : windowX)
+						{
+							if (nx != x || ny != y || nz != z)
+								neighbours.push_back(nx + (ny + nz * regionHeight) * regionWidth);
+						}
+				offsets.push_back(neighbours.size());
+			}
+		}
+	}
+}
+
+std::size_t CLTopology::neighbourListSize(int radius) const
+{
+	if (lists)
+		return lists->neighbours.size();
+
+	// Boxes are separable, so the sizes of the windows along each axis multiply
+	int half = radius < 0 ? std::max(regionWidth, std::max(regionHeight, regionDepth)) : radius / 2;
+	std::vector<int> window;
+	auto axisSum = [&](int size)
+	{
+		std::size_t sum = 0;
+		for (int i = 0; i < size; ++i)
+		{
+			axisWindow(i, size, half, wrap, window);
+			sum += window.size();
+		}
+		return sum;
+	};
+	return axisSum(regionWidth) * axisSum(regionHeight) * axisSum(regionDepth) - getColumns();
+}
+
+void CLTopology::validate() const
+{
+	if (inputWidth <= 0 || inputHeight <= 0 || inputDepth <= 0 || regionWidth <= 0 || regionHeight <= 0 || regionDepth <= 0)
+	{
+		throw std::runtime_error("Invalid topology dimensions!");
+	}
+	if (lists && (!validLists(lists->neighbourOffsets, lists->neighbours, getColumns(), getColumns(), true) ||
+		(!lists->receptiveFieldOffsets.empty() && !validLists(lists->receptiveFieldOffsets, lists->receptiveFields, getColumns(), getInputSize(), false))))
+	{
+		throw std::runtime_error("Invalid topology lists!");
+	}
+}
+
 std::string CLTopology::serialize() const
 {
+	bool receptiveFieldLists = lists && !lists->receptiveFieldOffsets.empty();
+
 	std::stringstream constants; constants
 	<< "constant int INPUT_WIDTH = "            << inputWidth           << ";"
 	<< "constant int INPUT_HEIGHT = "           << inputHeight          << ";"
+	<< "constant int INPUT_DEPTH = "            << inputDepth           << ";"
 	<< "constant int REGION_WIDTH = "           << regionWidth          << ";"
 	<< "constant int REGION_HEIGHT = "          << regionHeight         << ";"
-	<< "constant int INHIBITION_RADIUS = "      << inhibitionRadius     << ";"
-	<< "constant int RECEPTIVE_FIELD_RADIUS = " << receptiveFieldRadius << ";";
+	<< "constant int REGION_DEPTH = "           << regionDepth          << ";"
+	<< "constant int TOPOLOGY_WRAP = "          << wrap                 << ";"
+	<< "constant int RECEPTIVE_FIELD_RADIUS = " << receptiveFieldRadius << ";"
+	<< "constant int RECEPTIVE_FIELD_LISTS = "  << receptiveFieldLists  << ";";
 	return constants.str();
 }
@@ -2,61 +2,98 @@
 #define CLTOPOLOGY_H_INCLUDED
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+// Column neighbourhoods and receptive fields given as lists in compressed sparse row form: the entries of
+// column c are entries[offsets[c]] up to entries[offsets[c + 1]]. Neighbour lists exclude the column itself.
+struct CLTopologyLists
+{
+	std::vector<int> neighbourOffsets;
+	std::vector<int> neighbours;
+	std::vector<int> receptiveFieldOffsets; // empty to derive receptive fields from the input grid
+	std::vector<int> receptiveFields; // input bits
+};
 
 struct CLTopology
 {
 	// Input data topology
 	int inputWidth;
 	int inputHeight;
+	int inputDepth;
 
 	// Column topology
 	int regionWidth;
 	int regionHeight;
+	int regionDepth;
+
+	// Whether neighbourhoods and receptive fields wrap around the edges of the grid
+	bool wrap;
 
-	// How far the column's neighbourhood spans or -1 for global inhibition
+	// How far the column's neighbourhood spans or -1 for global inhibition. Passed to the kernels at run time,
+	// see CLArgs::AdaptiveInhibitionRadius
 	int inhibitionRadius;
 
 	// How far columns extend their receptive field in the input space or -1 for unlimited
 	int receptiveFieldRadius;
 
-	inline int getInputSize() const { return inputWidth * inputHeight; }
-	inline int getColumns() const { return regionWidth * regionHeight; }
+	// Fixed neighbourhoods for topologies that are not grids, null to derive them from the grid and inhibitionRadius
+	std::shared_ptr<const CLTopologyLists> lists;
+
+	inline int getInputSize() const { return inputWidth * inputHeight * inputDepth; }
+	inline int getColumns() const { return regionWidth * regionHeight * regionDepth; }
+
+	// Local inhibition of volumes and wrapped grids works through neighbour lists, plain 2D grids and lines are
+	// inhibited in tiles. Global inhibition always runs over the grid.
+	inline bool usesNeighbourLists(int radius) const { return lists || (radius >= 0 && (wrap || regionDepth > 1)); }
 
 	static CLTopology globalInhibition2D(int inputWidth, int inputHeight, int regionWidth, int regionHeight)
 	{
-		CLTopology ret;
-		ret.inputWidth = inputWidth;
-		ret.inputHeight = inputHeight;
-		ret.regionWidth = regionWidth;
-		ret.regionHeight = regionHeight;
-		ret.inhibitionRadius = -1;
-		ret.receptiveFieldRadius = -1;
-		return ret;
+		return volume(inputWidth, inputHeight, 1, regionWidth, regionHeight, 1, -1, -1);
 	}
 	static CLTopology localInhibition2D(int inputWidth, int inputHeight, int regionWidth, int regionHeight, int inhibitionRadius, int receptiveFieldRadius)
+	{
+		return volume(inputWidth, inputHeight, 1, regionWidth, regionHeight, 1, inhibitionRadius, receptiveFieldRadius);
+	}
+
+	static CLTopology line(int inputLength, int regionLength, int inhibitionRadius, int receptiveFieldRadius)
+	{
+		return volume(inputLength, 1, 1, regionLength, 1, 1, inhibitionRadius, receptiveFieldRadius);
+	}
+
+	// 3D grids, or 2D grids with a depth of 1. With wrap set, the grids are toroidal.
+	static CLTopology volume(int inputWidth, int inputHeight, int inputDepth, int regionWidth, int regionHeight, int regionDepth, int inhibitionRadius, int receptiveFieldRadius, bool wrap = false)
 	{
 		CLTopology ret;
 		ret.inputWidth = inputWidth;
 		ret.inputHeight = inputHeight;
+		ret.inputDepth = inputDepth;
 		ret.regionWidth = regionWidth;
 		ret.regionHeight = regionHeight;
+		ret.regionDepth = regionDepth;
+		ret.wrap = wrap;
 		ret.inhibitionRadius = inhibitionRadius;
 		ret.receptiveFieldRadius = receptiveFieldRadius;
 		return ret;
 	}
 
-	static CLTopology line(int inputLength, int regionLength, int inhibitionRadius, int receptiveFieldRadius)
+	// Columns connected as a graph, one column per neighbour list. Without receptive field lists every column
+	// may connect to any input bit.
+	static CLTopology graph(int inputSize, std::shared_ptr<const CLTopologyLists> lists)
 	{
-		CLTopology ret;
-		ret.inputWidth = inputLength;
-		ret.inputHeight = 1;
-		ret.regionWidth = regionLength;
-		ret.regionHeight = 1;
-		ret.inhibitionRadius = inhibitionRadius;
-		ret.receptiveFieldRadius = receptiveFieldRadius;
+		CLTopology ret = line(inputSize, int(lists->neighbourOffsets.size()) - 1, 0, -1);
+		ret.lists = lists;
 		return ret;
 	}
-	
+
+	// Neighbour lists of the columns for a neighbourhood of the given width, the fixed lists if there are any
+	void neighbourLists(int radius, std::vector<int>& offsets, std::vector<int>& neighbours) const;
+	// Number of entries neighbourLists() produces
+	std::size_t neighbourListSize(int radius) const;
+	// Throws if the fixed lists do not fit the topology
+	void validate() const;
+
 	std::string serialize() const;
 };
 
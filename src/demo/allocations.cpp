@@ -0,0 +1,66 @@
+#include <iostream>
+#include <cstdlib>
+#include <new>
+#include "../clregion.h"
+#include "../clrandom.h"
+
+// Checks that steps through CLRegion::write(const cl_char*, cl_char*) do not allocate on the host once the
+// region has warmed up. Every allocation goes through the operators below and is counted while counting is set.
+// Exits with 1 if a step allocated.
+
+namespace
+{
+	bool counting = false;
+	long allocations = 0;
+
+	void* allocate(std::size_t size)
+	{
+		if (counting)
+			allocations++;
+		void* p = std::malloc(size ? size : 1);
+		if (!p)
+			throw std::bad_alloc();
+		return p;
+	}
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+int main(int argc, char** argv)
+{
+	const int inputWidth = 80;
+	const int regionWidth = 80;
+	const int patterns = 8;
+	int warmSteps = argc > 1 ? std::atoi(argv[1]) : 2000;
+	int steps = argc > 2 ? std::atoi(argv[2]) : 1000;
+
+	CLContext context;
+	CLArgs args;
+	args.ColumnProximalSynapseCount = 5;
+	args.ColumnProximalSynapseMinOverlap = 3;
+	CLRegion region(context, CLTopology::localInhibition2D(inputWidth, 1, regionWidth, 1, 5, 5), args);
+
+	// A short repeating sequence, which the temporal pooler learns during warm-up so that its segment pool stops growing
+	CLRandom random(args.RandomSeed);
+	std::vector<cl_char> inputs(patterns * inputWidth);
+	for (cl_char& ch : inputs)
+		ch = random.next() % 4 == 0;
+	std::vector<cl_char> output(regionWidth);
+
+	float anomaly = 0;
+	for (int step = 0; step < warmSteps; ++step)
+		region.write(&inputs[step % patterns * inputWidth], &output[0], true, &anomaly);
+
+	counting = true;
+	for (int step = warmSteps; step < warmSteps + steps; ++step)
+		region.write(&inputs[step % patterns * inputWidth], &output[0], true, &anomaly);
+	counting = false;
+
+	std::cout << allocations << " allocations in " << steps << " steps" << std::endl;
+	return allocations == 0 ? 0 : 1;
+}
@@ -1,5 +1,7 @@
 #include <stdexcept>
 #include "../clregion.h"
+#include "../clrandom.h"
+#include "../clanomaly.h"
 
 int main()
 {
@@ -25,6 +27,9 @@ int main()
 		args
 	);
 
+	CLRandom random(args.RandomSeed);
+	CLAnomalyLikelihood likelihood;
+
 	int counter = 0;
 	while (true)
 	{
@@ -35,7 +40,7 @@ int main()
 		for (int i = 0; i < int(input.size()); ++i)
 		{
 			cl_char& ch = input[i];
-			ch = rand()%2;
+			ch = random.next()%2;
 			if (counter % 10000 < inputWidth*50)
 			{
 				ch = abs(i-(counter%10000)/50) < (inputWidth / 16);
@@ -44,13 +49,15 @@ int main()
 
 		std::vector<cl_char> output(regionWidth);
 
-		region.write(input, output);
+		float anomaly = 0;
+		region.write(input, output, true, &anomaly);
 
 		for (auto& ch: input)
 			std::cout << " #"[ch];
 		std::cout << "\n";
 		for (auto& ch: output)
 			std::cout << " #"[ch];
+		std::cout << "\nanomaly " << anomaly << " likelihood " << likelihood.update(anomaly);
 		std::cout << "\n\n" << std::flush;
 
 	}
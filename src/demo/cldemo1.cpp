@@ -1,7 +1,7 @@
 #include <random>
 #include "../clregion.h"
 #include "util.h"
-#include "sensor.h"
+#include "../clsensor.h"
 
 #include "SDL2/SDL.h"
 #include "SDL2/SDL_opengl.h"
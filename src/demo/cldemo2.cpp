@@ -1,7 +1,7 @@
 #include <thread>
 #include "../clregion.h"
 #include "util.h"
-#include "sensor.h"
+#include "../clsensor.h"
 
 #include "SDL2/SDL.h"
 #include "SDL2/SDL_opengl.h"
@@ -36,7 +36,7 @@ void demo2Loop(SDL_Window* window, bool& spaceDown)
 
 	double timer = 0;
 	const double dt = 0.01;
-	Sensor sensor(inputSize, 32);
+	CLSensor sensor(inputSize, 32);
 
 	int iterCount = 0;
 
@@ -48,8 +48,8 @@ void demo2Loop(SDL_Window* window, bool& spaceDown)
 
 	auto predict = [&](double input, bool /*learning*/)
 	{
-		// Encode to SDR via an instance of the Sensor class
-		dataIn = sensor.encode(input);
+		// Encode to SDR via an instance of the CLSensor class
+		sensor.encode(input, dataIn.data());
 
 		// Feed SDR to region, receive activation in dataOut
 		region.write(dataIn, dataOut, iterCount++ > temporalPoolerThreshold);
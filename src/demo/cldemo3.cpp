@@ -1,7 +1,7 @@
 #include <thread>
 #include "../clregion.h"
 #include "util.h"
-#include "sensor.h"
+#include "../clencoder.h"
 
 #include "SDL2/SDL.h"
 #include "SDL2/SDL_opengl.h"
@@ -47,6 +47,13 @@ void drawLine(double x1, double y1, double x2, double y2, double width, const T&
 	glEnd();
 }
 
+// Bits of one encoder field
+template <class T>
+T fieldBits(const T& bits, const CLEncoder& encoder, int field)
+{
+	return T(bits.begin() + encoder.fieldOffset(field), bits.begin() + encoder.fieldOffset(field) + encoder.fieldSize(field));
+}
+
 void demo3Loop(SDL_Window* window, bool& spaceDown)
 {
 	CLContext context;
@@ -57,14 +64,15 @@ void demo3Loop(SDL_Window* window, bool& spaceDown)
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	// Begin simulation init
 
-	// We need two sensors, one for each axis
+	// One scalar field for each axis
 	int sensorResolution = 100;
 	int sensorWindowSize = 10;
-	Sensor sensorX(sensorResolution, sensorWindowSize);
-	Sensor sensorY(sensorResolution, sensorWindowSize);
+	CLEncoder encoder(context);
+	int fieldX = encoder.addScalar(sensorResolution, sensorWindowSize);
+	int fieldY = encoder.addScalar(sensorResolution, sensorWindowSize);
 
-	// Input to the network is the two sensor readings concatenated
-	int inputSize = sensorResolution * 2;
+	// Input to the network is the two fields side by side
+	int inputSize = encoder.size();
 	int columns = 100;
 
 	int inhibitionRadius = 5;
@@ -82,14 +90,9 @@ void demo3Loop(SDL_Window* window, bool& spaceDown)
 
 	auto predict = [&](double inputX, double inputY)
 	{
-		// Encode to SDR via an instance of the Sensor class
-		auto dataInX = sensorX.encode(inputX);
-		auto dataInY = sensorY.encode(inputY);
-
-		// Concatenate sensor readings to form input
-		dataIn.clear();
-		dataIn.insert(dataIn.end(), dataInX.begin(), dataInX.end());
-		dataIn.insert(dataIn.end(), dataInY.begin(), dataInY.end());
+		// Encode both readings in place, the fields land next to each other in dataIn
+		double record[] = {inputX, inputY};
+		encoder.encode(record, dataIn.data());
 
 		// Feed input to region, receive activation in dataOut
 		region.write(dataIn, dataOut, false);
@@ -97,18 +100,18 @@ void demo3Loop(SDL_Window* window, bool& spaceDown)
 		// Find out what kind of input would cause this kind of region activation (noisy backwards convolution)
 		region.backwards(dataOut, noisyRemap);
 
-		// Use sensor to find out approximate input value that would cause this kind of SDR
+		// Use the fields' sensors to find out approximate input value that would cause this kind of SDR
 		// First split reading to two
-		std::vector<double> dataX(noisyRemap.begin(), noisyRemap.begin() + sensorResolution);
-		std::vector<double> dataY(noisyRemap.begin() + sensorResolution, noisyRemap.end());
+		std::vector<double> dataX = fieldBits(noisyRemap, encoder, fieldX);
+		std::vector<double> dataY = fieldBits(noisyRemap, encoder, fieldY);
 
-		drawLine(-1, -1, 1, -1, 0.05, dataInX);
+		drawLine(-1, -1, 1, -1, 0.05, fieldBits(dataIn, encoder, fieldX));
 		drawLine(-1, -1+0.1, 1, -1+0.1, 0.05, dataX);
 
-		drawLine(-1, -1, -1, 1, 0.05, dataInY);
+		drawLine(-1, -1, -1, 1, 0.05, fieldBits(dataIn, encoder, fieldY));
 		drawLine(-1+0.1, -1, -1+0.1, 1, 0.05, dataY);
 
-		return std::make_pair(sensorX.decode(dataX), sensorY.decode(dataY));
+		return std::make_pair(encoder.sensor(fieldX).decode(dataX), encoder.sensor(fieldY).decode(dataY));
 	};
 
 	double timer = 0;
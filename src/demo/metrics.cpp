@@ -0,0 +1,76 @@
+#include <iostream>
+#include <string>
+#include "../clregion.h"
+#include "../clrandom.h"
+
+// Steps a region, exports its metrics to a CLPrometheusSink and checks the scraped text. Exits with 1 on the
+// first line that is missing.
+
+namespace
+{
+	int failures = 0;
+
+	void expect(bool condition, const std::string& what)
+	{
+		if (!condition)
+		{
+			std::cerr << "Missing: " << what << std::endl;
+			failures++;
+		}
+	}
+
+	void expectLine(const std::string& text, const std::string& line)
+	{
+		expect(text.find("\n" + line + "\n") != std::string::npos || text.compare(0, line.size() + 1, line + "\n") == 0, line);
+	}
+	void expectPrefix(const std::string& text, const std::string& prefix)
+	{
+		expect(text.find("\n" + prefix) != std::string::npos, prefix);
+	}
+}
+
+int main()
+{
+	const int inputWidth = 80;
+	const int regionWidth = 80;
+	const int steps = 200;
+
+	CLContext context;
+	CLArgs args;
+	args.ColumnProximalSynapseCount = 5;
+	args.ColumnProximalSynapseMinOverlap = 3;
+	CLRegion region(context, CLTopology::localInhibition2D(inputWidth, 1, regionWidth, 1, 5, 5), args);
+
+	CLRandom random(args.RandomSeed);
+	std::vector<cl_char> input(inputWidth);
+	std::vector<cl_char> output(regionWidth);
+	for (int step = 0; step < steps; ++step)
+	{
+		for (cl_char& ch : input)
+			ch = random.next() % 4 == 0;
+		region.write(input, output);
+	}
+
+	// Label values are escaped
+	expect(CLMetrics::label("region", "a\"b\\c\nd") == "region=\"a\\\"b\\\\c\\nd\"", "escaped label");
+
+	CLPrometheusSink sink;
+	region.exportMetrics(sink, "a\"b\\c");
+	std::string text = sink.text();
+	const std::string labels = "region=\"a\\\"b\\\\c\"";
+
+	expectLine(text, "# TYPE corticl_steps_total counter");
+	expectLine(text, "corticl_steps_total{" + labels + "} " + std::to_string(steps));
+	expectLine(text, "# TYPE corticl_segment_pool_size gauge");
+	expectPrefix(text, "corticl_uploaded_bytes_total{" + labels + "} ");
+	expectPrefix(text, "corticl_downloaded_bytes_total{" + labels + "} ");
+	expectPrefix(text, "corticl_device_buffer_bytes{" + labels + ",buffer=\"Columns\"} ");
+	expectPrefix(text, "corticl_device_buffer_bytes{" + labels + ",buffer=\"Distal synapses\"} ");
+	expectLine(text, "corticl_kernel_launches_total{" + labels + ",kernel=\"computeOverlap\"} " + std::to_string(steps));
+	// Launched outside the step graphs
+	expectPrefix(text, "corticl_kernel_launches_total{" + labels + ",kernel=\"compactSegments\"} ");
+
+	if (failures)
+		std::cerr << text;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include "../clreplay.h"
+#include "../clrandom.h"
+
+// Replays the region of the basic demo to find where devices or kernel variants start to disagree:
+//   replay inputs <inputs> <steps>                  record inputs
+//   replay trace <inputs> <trace> [platform device] hash the state after every phase of every step
+//   replay compare <trace> <trace>                  first divergence of two traces, for runs on different hosts
+//   replay lockstep <inputs> <platform> <device> <platform> <device>
+//                                                   run two devices side by side and compare them exactly
+
+namespace
+{
+	const int inputWidth = 80;
+	const int regionWidth = 80;
+
+	CLTopology topology()
+	{
+		return CLTopology::localInhibition2D(inputWidth, 1, regionWidth, 1, 5, 5);
+	}
+
+	CLArgs arguments()
+	{
+		CLArgs args;
+		args.ColumnProximalSynapseCount = 5;
+		args.ColumnProximalSynapseMinOverlap = 3;
+		return args;
+	}
+
+	std::vector< std::vector<cl_char> > loadInputs(const char* path)
+	{
+		std::vector< std::vector<cl_char> > inputs;
+		if (!CLReplay::loadInputs(path, inputs))
+			throw std::runtime_error("Cannot read replay inputs!");
+		return inputs;
+	}
+
+	int usage()
+	{
+		std::cerr << "Usage: replay inputs <inputs> <steps>\n"
+			"       replay trace <inputs> <trace> [platform device]\n"
+			"       replay compare <trace> <trace>\n"
+			"       replay lockstep <inputs> <platform> <device> <platform> <device>" << std::endl;
+		return 2;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+		return usage();
+
+	if (!std::strcmp(argv[1], "inputs") && argc == 4)
+	{
+		// The moving bar of the basic demo over random noise
+		CLRandom random(arguments().RandomSeed);
+		std::vector< std::vector<cl_char> > inputs(std::atoi(argv[3]), std::vector<cl_char>(inputWidth));
+		for (int counter = 0; counter < int(inputs.size()); ++counter)
+		{
+			for (int i = 0; i < inputWidth; ++i)
+			{
+				cl_char& ch = inputs[counter][i];
+				ch = random.next() % 2;
+				if (counter % 10000 < inputWidth * 50)
+					ch = std::abs(i - (counter % 10000) / 50) < (inputWidth / 16);
+			}
+		}
+		CLReplay::saveInputs(argv[2], inputs);
+		return 0;
+	}
+	if (!std::strcmp(argv[1], "trace") && (argc == 4 || argc == 6))
+	{
+		CLContext context(argc == 6 ? std::atoi(argv[4]) : 0, argc == 6 ? std::atoi(argv[5]) : 0);
+		CLReplay::trace(context, topology(), arguments(), loadInputs(argv[2])).save(argv[3]);
+		return 0;
+	}
+	if (!std::strcmp(argv[1], "compare") && argc == 4)
+	{
+		CLReplayTrace a, b;
+		if (!CLReplayTrace::load(argv[2], a) || !CLReplayTrace::load(argv[3], b))
+			throw std::runtime_error("Cannot read replay trace!");
+		CLDivergence divergence = CLReplayTrace::compare(a, b);
+		std::cout << divergence.describe() << std::endl;
+		return divergence.diverged ? 1 : 0;
+	}
+	if (!std::strcmp(argv[1], "lockstep") && argc == 7)
+	{
+		CLContext a(std::atoi(argv[3]), std::atoi(argv[4]));
+		CLContext b(std::atoi(argv[5]), std::atoi(argv[6]));
+		CLDivergence divergence = CLReplay::lockstep(a, b, topology(), arguments(), loadInputs(argv[2]));
+		std::cout << divergence.describe() << std::endl;
+		return divergence.diverged ? 1 : 0;
+	}
+	return usage();
+}
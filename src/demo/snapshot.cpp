@@ -0,0 +1,118 @@
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include "../clregion.h"
+#include "../clrandom.h"
+#include "../clsnapshot.h"
+
+// Snapshots a region into a log, loads the log and restores it into a second region, which must then produce
+// the same outputs as the first. A torn and a damaged last record must leave the image at the snapshot before
+// it. Exits with 1 on the first mismatch.
+
+namespace
+{
+	int failures = 0;
+
+	void expect(bool condition, const std::string& what)
+	{
+		if (!condition)
+		{
+			std::cerr << "Failed: " << what << std::endl;
+			failures++;
+		}
+	}
+
+	std::vector<char> readFile(const std::string& path)
+	{
+		std::ifstream in(path.c_str(), std::ios::binary);
+		return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	void writeFile(const std::string& path, const std::vector<char>& data, std::size_t size)
+	{
+		std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+		out.write(data.data(), size);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const int inputWidth = 80;
+	const int regionWidth = 80;
+	const int snapshots = 6;
+	const int stepsPerSnapshot = 50;
+	const int replaySteps = 100;
+	std::string path = argc > 1 ? argv[1] : "snapshot_test.log";
+	std::string copyPath = path + ".copy";
+	std::remove(path.c_str());
+
+	CLContext context;
+	CLArgs args;
+	args.ColumnProximalSynapseCount = 5;
+	args.ColumnProximalSynapseMinOverlap = 3;
+	CLTopology topology = CLTopology::localInhibition2D(inputWidth, 1, regionWidth, 1, 5, 5);
+	CLRegion region(context, topology, args);
+
+	CLRandom random(args.RandomSeed);
+	std::vector<cl_char> input(inputWidth);
+	std::vector<cl_char> output(regionWidth);
+	std::vector<std::size_t> logSizes; // after each snapshot
+	{
+		CLSnapshotter snapshotter(region, path);
+		for (int snapshot = 0; snapshot < snapshots; ++snapshot)
+		{
+			for (int step = 0; step < stepsPerSnapshot; ++step)
+			{
+				for (cl_char& ch : input)
+					ch = random.next() % 4 == 0;
+				region.write(input, output);
+			}
+			snapshotter.snapshot();
+			snapshotter.flush();
+			logSizes.push_back(readFile(path).size());
+		}
+	}
+
+	CLSnapshotImage image;
+	expect(CLSnapshotter::load(path, image), "load");
+	expect(image.sequence == snapshots, "sequence of the last snapshot");
+
+	// The restored region carries on exactly like the original
+	CLRegion restored(context, topology, args);
+	restored.restore(image);
+	std::vector<cl_char> restoredOutput(regionWidth);
+	float anomaly = 0, restoredAnomaly = 0;
+	int mismatches = 0;
+	for (int step = 0; step < replaySteps; ++step)
+	{
+		for (cl_char& ch : input)
+			ch = random.next() % 4 == 0;
+		region.write(input, output, true, &anomaly);
+		restored.write(input, restoredOutput, true, &restoredAnomaly);
+		if (output != restoredOutput || anomaly != restoredAnomaly)
+			mismatches++;
+	}
+	expect(mismatches == 0, "restored outputs, " + std::to_string(mismatches) + " steps differ");
+
+	// A log cut off after the second to last snapshot is what a torn or damaged last record must load as
+	std::vector<char> log = readFile(path);
+	std::size_t previous = logSizes[snapshots - 2];
+	CLSnapshotImage expected;
+	writeFile(copyPath, log, previous);
+	expect(CLSnapshotter::load(copyPath, expected) && expected.sequence == snapshots - 1, "load of the previous snapshot");
+
+	CLSnapshotImage torn;
+	writeFile(copyPath, log, previous + (log.size() - previous) / 2);
+	expect(CLSnapshotter::load(copyPath, torn) && torn.sequence == expected.sequence && torn.sources == expected.sources, "torn record");
+
+	CLSnapshotImage damaged;
+	log[previous + (log.size() - previous) / 2] ^= 1;
+	writeFile(copyPath, log, log.size());
+	expect(CLSnapshotter::load(copyPath, damaged) && damaged.sequence == expected.sequence && damaged.sources == expected.sources, "damaged record");
+
+	std::remove(path.c_str());
+	std::remove(copyPath.c_str());
+	return failures == 0 ? 0 : 1;
+}